@@ -16,9 +16,28 @@
 #include "token.h"
 #include "tokenqueue.h"
 #include "scanner.h"
+#include "flightrec.h"
+#include "cancel.h"
 #include "parser.h"
 
 
+//
+// cancellation token of the parse in progress on this thread (NULL if
+// the parse can't be cancelled), polled once per statement; Cancelled
+// records that the parse gave up because of it:
+//
+static _Thread_local struct CancelToken* Cancel = NULL;
+static _Thread_local bool Cancelled = false;
+
+//
+// bodies currently open on this thread; nesting deeper than MAX_NESTING
+// is a syntax error, so pathological input can't exhaust the stack:
+//
+#define MAX_NESTING 1000
+
+static _Thread_local int Nesting = 0;
+
+
 //
 // declarations of private functions:
 //
@@ -317,6 +336,14 @@ static bool parser_function_call(struct TokenQueue* tokens) {
 //
 static bool parser_body(struct TokenQueue* tokens)
 {
+  if (Nesting >= MAX_NESTING) {
+    struct Token curToken = tokenqueue_peekToken(tokens);
+
+    printf("**SYNTAX ERROR @ (%d,%d): bodies nested more than %d deep\n",
+      curToken.line, curToken.col, MAX_NESTING);
+    return false;
+  }
+
   if (!match(tokens, nuPy_LEFT_BRACE, "{")) {
     return false; 
   }
@@ -325,7 +352,11 @@ static bool parser_body(struct TokenQueue* tokens)
     return false; 
   }
 
-  if (!parser_stmts(tokens)) {
+  Nesting++;
+  bool result = parser_stmts(tokens);
+  Nesting--;
+
+  if (!result) {
     return false; 
   }
 
@@ -348,54 +379,57 @@ static bool parser_body(struct TokenQueue* tokens)
 //
 static bool parser_else(struct TokenQueue* tokens)
 { 
-  struct Token nextToken = tokenqueue_peekToken(tokens); 
-  char* nextValue = tokenqueue_peekValue(tokens);
+  // an elif chain is parsed iteratively, so a long chain can't
+  // exhaust the stack:
+  while (true) {
+    struct Token nextToken = tokenqueue_peekToken(tokens); 
+    char* nextValue = tokenqueue_peekValue(tokens);
 
-  if (nextToken.id == nuPy_KEYW_ELIF) {
-    tokenqueue_dequeue(tokens); // move on from elif 
+    if (nextToken.id == nuPy_KEYW_ELIF) {
+      tokenqueue_dequeue(tokens); // move on from elif 
 
-    if (!parser_expr(tokens)) {
-      return false; 
-    }
+      if (!parser_expr(tokens)) {
+        return false; 
+      }
 
-    if (!match(tokens, nuPy_COLON, ":")) {
-      return false; 
-    }
+      if (!match(tokens, nuPy_COLON, ":")) {
+        return false; 
+      }
 
-    if (!match(tokens, nuPy_EOLN, "EOLN")) {
-      return false; 
-    }
+      if (!match(tokens, nuPy_EOLN, "EOLN")) {
+        return false; 
+      }
 
-    if (!parser_body(tokens)) {
-      return false; 
-    }
+      if (!parser_body(tokens)) {
+        return false; 
+      }
 
-    struct Token optionalelse = tokenqueue_peekToken(tokens); //optional else handling 
-    if (optionalelse.id == nuPy_KEYW_ELSE || optionalelse.id == nuPy_KEYW_ELIF) {
-      bool result = parser_else(tokens); 
-      return result; 
-    }
+      struct Token optionalelse = tokenqueue_peekToken(tokens); //optional else handling 
+      if (optionalelse.id == nuPy_KEYW_ELSE || optionalelse.id == nuPy_KEYW_ELIF) {
+        continue; // parse the rest of the chain
+      }
 
-    return true; 
-  } else if (nextToken.id == nuPy_KEYW_ELSE) {
-    tokenqueue_dequeue(tokens); //move on from else 
+      return true; 
+    } else if (nextToken.id == nuPy_KEYW_ELSE) {
+      tokenqueue_dequeue(tokens); //move on from else 
 
-    if (!match(tokens, nuPy_COLON, ":")) {
-      return false; 
-    }
+      if (!match(tokens, nuPy_COLON, ":")) {
+        return false; 
+      }
 
-    if (!match(tokens, nuPy_EOLN, "EOLN")) {
-      return false; 
-    }
+      if (!match(tokens, nuPy_EOLN, "EOLN")) {
+        return false; 
+      }
 
-    if (!parser_body(tokens)) {
+      if (!parser_body(tokens)) {
+        return false; 
+      }
+
+      return true; 
+    } else {
+      errorMsg("else or elif", nextValue, nextToken); // if token wasn't else of elif => error 
       return false; 
     }
-
-    return true; 
-  } else {
-    errorMsg("else or elif", nextValue, nextToken); // if token wasn't else of elif => error 
-    return false; 
   }
 }
 
@@ -622,6 +656,14 @@ static bool startOfStmt(struct TokenQueue* tokens)
 //
 static bool parser_stmt(struct TokenQueue* tokens)
 {
+  if (cancel_poll(Cancel)) {
+    Cancelled = true;
+    return false; // cancelled, give up quietly
+  }
+
+  struct Token first = tokenqueue_peekToken(tokens);
+  flightrec_record(first.line, first.col, first.id);
+
   if (!startOfStmt(tokens)) {
     struct Token curToken = tokenqueue_peekToken(tokens);
     char* curValue = tokenqueue_peekValue(tokens);
@@ -674,17 +716,15 @@ static bool parser_stmt(struct TokenQueue* tokens)
 //
 static bool parser_stmts(struct TokenQueue* tokens)
 {
-  if (!parser_stmt(tokens)) {
-    return false; 
-  }
-  
-  if (startOfStmt(tokens)) {
-    bool result = parser_stmts(tokens); // optional stmt is there, so recursively parse
-    return result; 
-  }
+  // parsed iteratively rather than recursing per stmt, so a long
+  // sequence of stmts can't exhaust the stack:
+  do {
+    if (!parser_stmt(tokens)) {
+      return false; 
+    }
+  } while (startOfStmt(tokens)); // optional stmt is there, so keep parsing
 
   return true; // optional stmt not there, success => true
-  
 }
 
 
@@ -725,6 +765,26 @@ static bool parser_program(struct TokenQueue* tokens)
 //
 struct TokenQueue* parser_parse(FILE* input)
 {
+  return parser_parseCancellable(input, NULL, NULL);
+}
+
+
+//
+// parser_parseCancellable
+//
+// parser_parse, polling the given cancellation token (if any) once
+// per token while scanning and once per statement while parsing.
+// The outcome is returned via status.
+//
+struct TokenQueue* parser_parseCancellable(FILE* input, struct CancelToken* cancel, int* status)
+{
+  int ignored;
+
+  if (status == NULL)
+    status = &ignored;
+
+  *status = PARSE_SYNTAX_ERROR;
+
   if (input == NULL) {
     printf("**INTERNAL ERROR: input stream is NULL (parser_parse)\n");
     return NULL;
@@ -735,7 +795,7 @@ struct TokenQueue* parser_parse(FILE* input)
   // into a queue:
   //
   int lineNumber, colNumber;
-  char value[256];
+  char value[SCANNER_MAX_VALUE];
   struct Token token;
   struct TokenQueue* tokens;
 
@@ -746,6 +806,13 @@ struct TokenQueue* parser_parse(FILE* input)
 
   while (token.id != nuPy_EOS)
   {
+    if (cancel_poll(cancel))  // give up, nothing to parse:
+    {
+      tokenqueue_destroy(tokens);
+      *status = PARSE_CANCELLED;
+      return NULL;
+    }
+
     tokenqueue_enqueue(tokens, token, value);
 
     token = scanner_nextToken(input, &lineNumber, &colNumber, value);
@@ -767,8 +834,14 @@ struct TokenQueue* parser_parse(FILE* input)
   //
   // okay, now let's parse the input tokens:
   //
+  Cancel = cancel;
+  Cancelled = false;
+  Nesting = 0;
+
   bool result = parser_program(tokens);
 
+  Cancel = NULL;
+
   //
   // When we are done parsing, we are going to 
   // execute (assuming the parse was successful).
@@ -790,10 +863,14 @@ struct TokenQueue* parser_parse(FILE* input)
 
   if (result) // parse was successful
   {
+    *status = PARSE_OK;
     return duplicate;
   }
-  else  // syntax error, nothing to execute:
+  else  // syntax error or cancelled, nothing to execute:
   {
+    if (Cancelled)
+      *status = PARSE_CANCELLED;
+
     tokenqueue_destroy(duplicate);
 
     return NULL;
@@ -8,6 +8,20 @@
 #include <stdbool.h>  
 
 #include "tokenqueue.h"
+#include "cancel.h"
+
+
+//
+// ParseStatus
+//
+// Outcome of a parse, see parser_parseCancellable.
+//
+enum ParseStatus
+{
+  PARSE_OK,
+  PARSE_SYNTAX_ERROR,
+  PARSE_CANCELLED
+};
 
 
 //
@@ -17,3 +31,15 @@
 // and then checks the syntax of the input against the BNF rules
 // of the language 
 struct TokenQueue* parser_parse(FILE* input);
+
+
+//
+// parser_parseCancellable
+//
+// Like parser_parse, but the scan and the parse poll the given
+// cancellation token (which may be NULL) and give up promptly once
+// it is cancelled or its deadline passes. Returns NULL unless the
+// parse succeeded; the outcome is returned via status (if not NULL).
+// A cancelled parse outputs no error message.
+//
+struct TokenQueue* parser_parseCancellable(FILE* input, struct CancelToken* cancel, int* status);
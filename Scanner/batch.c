@@ -0,0 +1,805 @@
+/*batch.c*/
+
+//
+// Batch checker: scans many nuPython files in parallel, overlapping
+// the loading of files with the scanning of those already loaded.
+//
+// Files with identical bytes are only scanned once: each file's
+// contents are hashed, and files whose contents have already been
+// seen share that content's result. Diagnostics (the scanner's warnings
+// included) are recorded without a filename and labelled with each
+// file's own path on output.
+//
+// Files are stat'd up front and handed out largest-first, so one big
+// file at the end of the list doesn't leave the other workers idle;
+// very large contents are also split at line boundaries into chunks
+// that are scanned in parallel.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>    // true, false
+#include <string.h>     // memcmp, memchr
+#include <time.h>       // clock_gettime
+#include <unistd.h>     // sysconf
+#include <sys/stat.h>   // stat
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "structscan.h"
+#include "loader.h"
+#include "intern.h"
+#include "cancel.h"
+#include "batch.h"
+
+
+#define QUEUE_CAPACITY 64           // loaded files waiting for a worker
+#define CHUNK_BYTES    (256*1024)   // contents at least twice this are split
+#define MAX_CHUNKS     64
+#define OUTPUT_BLOCK   (64*1024)    // diagnostics written out at a time
+
+
+//
+// Diagnostic
+//
+// One problem found in a file's contents: an error, or a warning
+// from the scanner (which doesn't count as an error).
+//
+struct Diagnostic
+{
+  int   line;
+  int   col;
+  bool  warning;
+  char* message;
+};
+
+//
+// Result
+//
+// The outcome of checking one distinct file content. Results are
+// kept in a hash table keyed by the content's hash (and confirmed by
+// comparing bytes), so the data is retained until the batch is done.
+//
+struct Result
+{
+  uint64_t           hash;
+  char*              data;
+  size_t             length;
+
+  struct Diagnostic* diagnostics;  // protected by the batch lock
+  int                count;
+  int                capacity;
+
+  atomic_llong       scanNs;  // total scan time, summed over chunks
+  int                chunks;  // 1 unless the contents were split
+  bool               simulated;
+
+  struct Result*     next;  // hash chain
+};
+
+//
+// Chunk
+//
+// A range of a result's contents, starting at the beginning of the
+// given line, waiting to be scanned by any worker.
+//
+struct Chunk
+{
+  struct Result* R;
+  size_t         offset;
+  size_t         length;
+  int            startLine;
+  struct Chunk*  next;
+};
+
+//
+// Batch
+//
+// Shared state of a batch check. results[f] is the result for file f,
+// or NULL if the file could not be read. Files are loaded largest-first;
+// order[i] is the file loaded i-th.
+//
+struct Batch
+{
+  char**              files;
+  int                 fileCount;
+  int*                order;
+  struct Loader*      loader;
+  struct Result**     results;
+  struct InternTable* symbols;   // identifiers, shared by all workers
+  double              timeoutMs;
+  int                 threads;
+
+  pthread_mutex_t     lock;      // protects the table, chunks and diagnostics:
+  struct Result**     buckets;
+  int                 bucketCount;
+  struct Chunk*       chunks;    // pending chunks of split contents
+  atomic_int          chunkCount;  // of chunks, readable without the lock
+
+  atomic_long         tokens;
+  atomic_int          duplicates;
+  atomic_long         skippedBytes;
+};
+
+
+//
+// add_diagnostic
+//
+// Records a problem at the given position of a result; the result
+// takes ownership of the message.
+//
+static void add_diagnostic(struct Batch* B, struct Result* R, int line, int col, bool warning, char* message)
+{
+  pthread_mutex_lock(&B->lock);
+
+  if (R->count == R->capacity)
+  {
+    R->capacity = (R->capacity == 0) ? 8 : R->capacity * 2;
+    R->diagnostics = (struct Diagnostic*)reallocMemory(R->diagnostics, sizeof(struct Diagnostic) * R->capacity);
+    if (R->diagnostics == NULL) panic("out of memory (add_diagnostic)");
+  }
+
+  R->diagnostics[R->count].line = line;
+  R->diagnostics[R->count].col = col;
+  R->diagnostics[R->count].warning = warning;
+  R->diagnostics[R->count].message = message;
+  R->count++;
+
+  pthread_mutex_unlock(&B->lock);
+}
+
+
+//
+// Range
+//
+// The result whose contents a worker is scanning, for record_warning.
+//
+struct Range
+{
+  struct Batch*  B;
+  struct Result* R;
+};
+
+
+//
+// record_warning
+//
+// Scanner warning handler: records the warning as a diagnostic of the
+// result being scanned, rather than outputting it unlabelled.
+//
+static void record_warning(void* arg, int line, int col)
+{
+  struct Range* range = (struct Range*)arg;
+
+  add_diagnostic(range->B, range->R, line, col, true, dupString("string literal not terminated properly"));
+}
+
+
+static int compare_diagnostics(const void* a, const void* b)
+{
+  const struct Diagnostic* x = (const struct Diagnostic*)a;
+  const struct Diagnostic* y = (const struct Diagnostic*)b;
+
+  if (x->line != y->line)
+    return (x->line > y->line) - (x->line < y->line);
+
+  return (x->col > y->col) - (x->col < y->col);
+}
+
+
+//
+// claim_result
+//
+// Looks up the loaded file's contents in the table. If the contents
+// have been seen before, returns that result and sets *isNew to false;
+// otherwise inserts a new (empty) result that takes ownership of the
+// file's data, and sets *isNew to true.
+//
+static struct Result* claim_result(struct Batch* B, struct LoadedFile* file, bool* isNew)
+{
+  uint64_t hash = hashBytes(file->data, file->length);
+  int b = (int)(hash & (uint64_t)(B->bucketCount - 1));
+
+  pthread_mutex_lock(&B->lock);
+
+  for (struct Result* R = B->buckets[b]; R != NULL; R = R->next)
+  {
+    if (R->hash == hash && R->length == file->length && memcmp(R->data, file->data, file->length) == 0)
+    {
+      pthread_mutex_unlock(&B->lock);
+      *isNew = false;
+      return R;
+    }
+  }
+
+  struct Result* R = (struct Result*)callocMemory(1, sizeof(struct Result));
+  if (R == NULL) panic("out of memory (claim_result)");
+
+  R->hash = hash;
+  R->data = file->data;
+  R->length = file->length;
+  R->next = B->buckets[b];
+  B->buckets[b] = R;
+
+  file->data = NULL;  // now owned by the result
+
+  pthread_mutex_unlock(&B->lock);
+
+  *isNew = true;
+  return R;
+}
+
+
+//
+// check_range
+//
+// Scans length bytes of the result's contents starting at offset (the
+// start of line startLine), recording a diagnostic for every problem
+// and interning every identifier into the shared symbol table. Gives
+// up with a diagnostic if checking takes longer than timeoutMs.
+//
+static void check_range(struct Batch* B, struct Result* R, size_t offset, size_t length, int startLine)
+{
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct StringBuilder message;
+  long tokens = 0;
+
+  sbInit(&message);
+
+  struct CancelToken cancel;
+  cancel_init(&cancel);
+  cancel_setTimeout(&cancel, B->timeoutMs);
+
+  //
+  // the contents are already in memory, so they are scanned with the
+  // structural scanner, which polls the deadline once per token:
+  //
+  struct TokenArray* A = tokenarray_create();
+  struct Range range = { B, R };
+
+  scanner_setWarningHandler(record_warning, &range);
+  bool finished = structscan_scanLines(A, R->data + offset, length, startLine, &cancel);
+  scanner_setWarningHandler(NULL, NULL);
+
+  for (int i = 0; i < A->count - 1; i++)  // all but the EOS
+  {
+    struct Token T = A->tokens[i];
+    char* value = tokenarray_value(A, i);
+
+    tokens++;
+
+    if (T.id == nuPy_IDENTIFIER)
+    {
+      intern_symbol(B->symbols, value);
+    }
+    else if (T.id == nuPy_UNKNOWN)
+    {
+      sbAppend(&message, "unknown token '");
+      sbAppend(&message, value);
+      sbAppend(&message, "'");
+      add_diagnostic(B, R, T.line, T.col, false, sbFinish(&message));
+    }
+  }
+
+  if (!finished)  // reported where the scan stopped, at the EOS
+  {
+    struct Token T = A->tokens[A->count - 1];
+
+    sbAppendFormat(&message, "cancelled, scan exceeded %.0f ms", B->timeoutMs);
+    add_diagnostic(B, R, T.line, T.col, false, sbFinish(&message));
+  }
+
+  tokenarray_destroy(A);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  atomic_fetch_add(&B->tokens, tokens);
+  atomic_fetch_add(&R->scanNs, (long long)(stop.tv_sec - start.tv_sec) * 1000000000 + (stop.tv_nsec - start.tv_nsec));
+}
+
+
+//
+// check_contents
+//
+// Checks the result's contents. Large contents are split at line
+// boundaries: all but the first chunk are queued for any worker to
+// take, and the calling worker scans the first. Contents containing
+// '$' are never split, since the scanner stops at the first '$'.
+//
+static void check_contents(struct Batch* B, struct Result* R)
+{
+  R->chunks = 1;
+
+  if (R->length == 0)  // nothing to scan
+    return;
+
+  int pieces = (int)(R->length / CHUNK_BYTES);
+  if (pieces > MAX_CHUNKS)
+    pieces = MAX_CHUNKS;
+
+  if (B->threads == 1 || pieces < 2 || memchr(R->data, '$', R->length) != NULL)
+  {
+    check_range(B, R, 0, R->length, 1);
+    return;
+  }
+
+  //
+  // find the chunk boundaries, just past a newline, counting lines
+  // so each chunk knows its starting line number:
+  //
+  size_t target = R->length / pieces;
+  size_t first = 0;
+  size_t offset = 0;
+  int line = 1;
+  int count = 0;
+
+  while (offset < R->length)
+  {
+    size_t end = offset + target;
+
+    if (end >= R->length || count == pieces - 1)
+      end = R->length;
+    else
+    {
+      char* newline = (char*)memchr(R->data + end, '\n', R->length - end);
+      end = (newline == NULL) ? R->length : (size_t)(newline - R->data) + 1;
+    }
+
+    if (count == 0)
+      first = end;
+    else
+    {
+      struct Chunk* C = (struct Chunk*)allocMemory(sizeof(struct Chunk));
+      if (C == NULL) panic("out of memory (check_contents)");
+
+      C->R = R;
+      C->offset = offset;
+      C->length = end - offset;
+      C->startLine = line;
+
+      pthread_mutex_lock(&B->lock);
+      C->next = B->chunks;
+      B->chunks = C;
+      atomic_fetch_add(&B->chunkCount, 1);
+      pthread_mutex_unlock(&B->lock);
+    }
+
+    for (char* p = R->data + offset; (p = (char*)memchr(p, '\n', R->data + end - p)) != NULL; p++)
+      line++;
+
+    offset = end;
+    count++;
+  }
+
+  R->chunks = count;
+
+  // workers waiting for I/O can take the chunks now:
+  loader_wake(B->loader);
+
+  check_range(B, R, 0, first, 1);
+}
+
+
+//
+// take_chunk
+//
+// Removes and returns a pending chunk, or NULL if there are none.
+//
+static struct Chunk* take_chunk(struct Batch* B)
+{
+  pthread_mutex_lock(&B->lock);
+
+  struct Chunk* C = B->chunks;
+  if (C != NULL)
+  {
+    B->chunks = C->next;
+    atomic_fetch_sub(&B->chunkCount, 1);
+  }
+
+  pthread_mutex_unlock(&B->lock);
+
+  return C;
+}
+
+
+//
+// chunks_ready
+//
+// For loader_nextOr: true if there are chunks waiting to be taken.
+//
+static bool chunks_ready(void* arg)
+{
+  struct Batch* B = (struct Batch*)arg;
+
+  return atomic_load(&B->chunkCount) > 0;
+}
+
+
+//
+// batch_worker
+//
+// Thread body: takes loaded files from the loader as they complete
+// and checks each distinct content once, until every file has been
+// handed out. Pending chunks of split contents are taken first, and a
+// worker waiting for I/O is woken to take chunks as they are queued.
+//
+static void* batch_worker(void* arg)
+{
+  struct Batch* B = (struct Batch*)arg;
+  struct LoadedFile* file;
+  struct Chunk* C;
+
+  while (true)
+  {
+    if ((C = take_chunk(B)) != NULL)
+    {
+      check_range(B, C->R, C->offset, C->length, C->startLine);
+      freeMemory(C);
+      continue;
+    }
+
+    bool done;
+
+    if ((file = loader_nextOr(B->loader, chunks_ready, B, &done)) == NULL)
+    {
+      if (done)
+        break;
+
+      continue;  // woken for a chunk
+    }
+
+    if (file->ok)
+    {
+      bool isNew;
+      struct Result* R = claim_result(B, file, &isNew);
+
+      B->results[B->order[file->index]] = R;
+
+      if (isNew)
+      {
+        check_contents(B, R);
+      }
+      else
+      {
+        atomic_fetch_add(&B->duplicates, 1);
+        atomic_fetch_add(&B->skippedBytes, (long)file->length);
+      }
+    }
+
+    loader_free(file);
+  }
+
+  //
+  // every file has been handed out, help with any remaining chunks:
+  //
+  while ((C = take_chunk(B)) != NULL)
+  {
+    check_range(B, C->R, C->offset, C->length, C->startLine);
+    freeMemory(C);
+  }
+
+  return NULL;
+}
+
+
+//
+// simulate_makespan
+//
+// Returns the makespan (in ns) of list-scheduling the given job times,
+// in order, onto the given number of workers: each job goes to the
+// worker that becomes free first.
+//
+static long long simulate_makespan(long long* jobs, int count, int threads)
+{
+  long long* busy = (long long*)callocMemory((size_t)threads, sizeof(long long));
+  if (busy == NULL) panic("out of memory (simulate_makespan)");
+
+  long long makespan = 0;
+
+  for (int j = 0; j < count; j++)
+  {
+    int w = 0;
+
+    for (int t = 1; t < threads; t++)
+      if (busy[t] < busy[w])
+        w = t;
+
+    busy[w] += jobs[j];
+
+    if (busy[w] > makespan)
+      makespan = busy[w];
+  }
+
+  freeMemory(busy);
+
+  return makespan;
+}
+
+
+//
+// FileSize
+//
+// A file's index and size, for ordering the files largest-first.
+//
+struct FileSize
+{
+  long long size;
+  int       index;
+};
+
+
+static int compare_sizes(const void* a, const void* b)
+{
+  const struct FileSize* x = (const struct FileSize*)a;
+  const struct FileSize* y = (const struct FileSize*)b;
+
+  if (x->size != y->size)
+    return (x->size < y->size) - (x->size > y->size);  // descending
+
+  return (x->index > y->index) - (x->index < y->index);
+}
+
+
+//
+// batch_check
+//
+// Checks the given files in parallel and outputs the diagnostics in
+// file order; returns the number of errors found.
+//
+int batch_check(char** files, int fileCount, int threads, double timeoutMs)
+{
+  if (files == NULL && fileCount > 0)
+    panic("files is NULL (batch_check)");
+
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads < 1)
+    threads = 1;
+
+  struct Batch B;
+
+  B.files = files;
+  B.fileCount = fileCount;
+  B.timeoutMs = timeoutMs;
+  B.threads = threads;
+  B.chunks = NULL;
+  B.results = (struct Result**)callocMemory((size_t)fileCount + 1, sizeof(struct Result*));
+
+  B.bucketCount = 64;
+  while (B.bucketCount < 2 * fileCount)
+    B.bucketCount *= 2;
+
+  B.buckets = (struct Result**)callocMemory((size_t)B.bucketCount, sizeof(struct Result*));
+  if (B.results == NULL || B.buckets == NULL) panic("out of memory (batch_check)");
+
+  B.symbols = intern_create(16);
+
+  pthread_mutex_init(&B.lock, NULL);
+  atomic_init(&B.chunkCount, 0);
+  atomic_init(&B.tokens, 0);
+  atomic_init(&B.duplicates, 0);
+  atomic_init(&B.skippedBytes, 0);
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  //
+  // stat the files and load them largest-first; a file that can't be
+  // stat'd sorts last and is reported when the loader fails on it:
+  //
+  struct FileSize* sizes = (struct FileSize*)allocMemory(sizeof(struct FileSize) * ((size_t)fileCount + 1));
+  B.order = (int*)allocMemory(sizeof(int) * ((size_t)fileCount + 1));
+  char** sorted = (char**)allocMemory(sizeof(char*) * ((size_t)fileCount + 1));
+
+  if (sizes == NULL || B.order == NULL || sorted == NULL)
+    panic("out of memory (batch_check)");
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    struct stat st;
+
+    sizes[f].size = (stat(files[f], &st) == 0) ? (long long)st.st_size : -1;
+    sizes[f].index = f;
+  }
+
+  qsort(sizes, fileCount, sizeof(struct FileSize), compare_sizes);
+
+  for (int i = 0; i < fileCount; i++)
+  {
+    B.order[i] = sizes[i].index;
+    sorted[i] = files[sizes[i].index];
+  }
+
+  B.loader = loader_start(sorted, fileCount, QUEUE_CAPACITY);
+
+  pthread_t* workers = (pthread_t*)allocMemory(sizeof(pthread_t) * threads);
+  if (workers == NULL) panic("out of memory (batch_check)");
+
+  for (int t = 0; t < threads; t++)
+  {
+    if (pthread_create(&workers[t], NULL, batch_worker, &B) != 0)
+      panic("unable to create thread (batch_check)");
+  }
+
+  for (int t = 0; t < threads; t++)
+    pthread_join(workers[t], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  char* method = loader_method(B.loader);
+  loader_finish(B.loader);
+
+  // warnings are recorded as the contents are scanned, before the
+  // errors, and chunks record theirs in whatever order they finish:
+  for (int b = 0; b < B.bucketCount; b++)
+    for (struct Result* R = B.buckets[b]; R != NULL; R = R->next)
+      if (R->count > 1)
+        qsort(R->diagnostics, R->count, sizeof(struct Diagnostic), compare_diagnostics);
+
+  //
+  // output the diagnostics, labelled with each file's own path:
+  //
+  // rendered into a builder and written out in large blocks:
+  struct StringBuilder output;
+  int errors = 0;
+
+  sbInit(&output);
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    struct Result* R = B.results[f];
+
+    if (R == NULL)
+    {
+      sbAppend(&output, "**ERROR ");
+      sbAppend(&output, files[f]);
+      sbAppend(&output, ": unable to open input file for input\n");
+      errors++;
+      continue;
+    }
+
+    for (int d = 0; d < R->count; d++)
+    {
+      sbAppend(&output, R->diagnostics[d].warning ? "**WARNING " : "**ERROR ");
+      sbAppend(&output, files[f]);
+      sbAppend(&output, " @ (");
+      sbAppendInt(&output, R->diagnostics[d].line);
+      sbAppend(&output, ", ");
+      sbAppendInt(&output, R->diagnostics[d].col);
+      sbAppend(&output, "): ");
+      sbAppend(&output, R->diagnostics[d].message);
+      sbAppend(&output, "\n");
+
+      if (!R->diagnostics[d].warning)
+        errors++;
+
+      if (output.length >= OUTPUT_BLOCK)
+      {
+        fwrite(output.data, 1, output.length, stdout);
+        sbReset(&output);
+      }
+    }
+  }
+
+  fwrite(output.data, 1, output.length, stdout);
+  sbFree(&output);
+
+  double ms = (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_nsec - start.tv_nsec) / 1000000.0;
+
+  printf("**CHECK: %d files, %ld tokens, %d errors (%.3f ms, %d threads, %s loader)\n",
+    fileCount, atomic_load(&B.tokens), errors, ms, threads, method);
+  printf("**DEDUP: %d duplicate files not rescanned (%ld bytes skipped)\n",
+    atomic_load(&B.duplicates), atomic_load(&B.skippedBytes));
+  printf("**SYMBOLS: %d distinct identifiers\n", intern_count(B.symbols));
+
+  //
+  // compare schedules using the measured scan times: whole files in
+  // file order (the naive schedule) against largest-first with large
+  // contents split into chunks. A duplicate costs nothing, as it isn't
+  // rescanned:
+  //
+  // one job per file in file order, one per chunk of each distinct
+  // content largest-first:
+  size_t jobCount = (size_t)fileCount, chunkCount = 0;
+
+  for (int b = 0; b < B.bucketCount; b++)
+    for (struct Result* R = B.buckets[b]; R != NULL; R = R->next)
+      chunkCount += (size_t)R->chunks;
+
+  if (chunkCount > jobCount)
+    jobCount = chunkCount;
+
+  long long* jobs = (long long*)allocMemory(sizeof(long long) * (jobCount + 1));
+  if (jobs == NULL) panic("out of memory (batch_check)");
+
+  int count = 0;
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    struct Result* R = B.results[f];
+
+    if (R != NULL)
+      R->simulated = false;
+  }
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    struct Result* R = B.results[f];
+
+    jobs[count++] = (R != NULL && !R->simulated) ? atomic_load(&R->scanNs) : 0;
+
+    if (R != NULL)
+      R->simulated = true;
+  }
+
+  double naive = simulate_makespan(jobs, count, threads) / 1000000.0;
+
+  int split = 0;
+  count = 0;
+
+  for (int i = 0; i < fileCount; i++)
+  {
+    struct Result* R = B.results[B.order[i]];
+
+    if (R == NULL || !R->simulated)  // unreadable, or already counted
+      continue;
+
+    for (int c = 0; c < R->chunks; c++)
+      jobs[count++] = atomic_load(&R->scanNs) / R->chunks;
+
+    if (R->chunks > 1)
+      split++;
+
+    R->simulated = false;
+  }
+
+  double scheduled = simulate_makespan(jobs, count, threads) / 1000000.0;
+
+  // simulated, not measured: a split file's time is divided evenly
+  // among its chunks, and the real run's wall time is in **CHECK:
+  printf("**SCHEDULE: simulated scan makespan %.3f ms largest-first vs %.3f ms in file order (%d threads, %d files split into chunks)\n",
+    scheduled, naive, threads, split);
+
+  freeMemory(jobs);
+
+  //
+  // done, free memory:
+  //
+  for (int b = 0; b < B.bucketCount; b++)
+  {
+    struct Result* R = B.buckets[b];
+
+    while (R != NULL)
+    {
+      struct Result* next = R->next;
+
+      for (int d = 0; d < R->count; d++)
+        freeMemory(R->diagnostics[d].message);
+
+      freeMemory(R->diagnostics);
+      freeMemory(R->data);
+      freeMemory(R);
+
+      R = next;
+    }
+  }
+
+  pthread_mutex_destroy(&B.lock);
+  intern_destroy(B.symbols);
+
+  freeMemory(workers);
+  freeMemory(sizes);
+  freeMemory(sorted);
+  freeMemory(B.order);
+  freeMemory(B.results);
+  freeMemory(B.buckets);
+
+  return errors;
+}
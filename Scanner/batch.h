@@ -0,0 +1,36 @@
+/*batch.h*/
+
+#pragma once
+
+
+//
+// batch_check
+//
+// Checks the given files in parallel: the files are loaded in the
+// background (see loader.h) and handed to the given number of
+// scanner worker threads (<= 0 means one per CPU) as they arrive.
+// Every problem found is output as
+//
+//   **ERROR file @ (line, col): message
+//
+// in file order, followed by a summary line. Files whose bytes are
+// identical to an earlier file's are not scanned again; they share
+// that file's diagnostics, and a second summary line reports how many
+// files (and bytes) were skipped this way.
+//
+// Files are stat'd up front and loaded largest-first; contents large
+// enough to keep one worker busy on their own are split at line
+// boundaries into chunks scanned by any idle worker (a worker waiting
+// for I/O is woken to take them). A final summary line compares the
+// simulated scan makespan of this schedule against handing out whole
+// files in file order, computed from the measured per-file scan times
+// (a split file's time divided evenly among its chunks); the measured
+// wall time is the one on the first summary line.
+//
+// If timeoutMs > 0, scanning a file (or chunk) is cancelled once it has taken
+// longer than that, and reported as an error, so one pathological
+// input can't hold a worker indefinitely.
+//
+// Returns the number of errors found.
+//
+int batch_check(char** files, int fileCount, int threads, double timeoutMs);
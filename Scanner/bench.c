@@ -0,0 +1,641 @@
+/*bench.c*/
+
+//
+// Benchmark harness: times measured regions over in-memory inputs,
+// so file I/O is excluded, and optionally wraps each region with
+// hardware performance counters to show why a change helped or hurt.
+// Also generates synthetic programs to compare against CPython.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>  // true, false
+#include <string.h>   // strlen
+#include <time.h>     // clock_gettime
+#include <unistd.h>   // close, unlink
+#include <sys/stat.h> // stat
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "structscan.h"
+#include "perfcount.h"
+#include "bench.h"
+
+
+//
+// Input
+//
+// One benchmark input, read into memory.
+//
+struct Input
+{
+  char*  data;
+  size_t length;
+};
+
+//
+// BenchRegion
+//
+// A measured region: run() processes one input and returns the number
+// of tokens it consumed.
+//
+struct BenchRegion
+{
+  char* label;
+  long  (*run)(char* data, size_t length);
+};
+
+
+//
+// scan_region
+//
+// Scans the input to the end with scanner_nextToken, the scanner for
+// streams, through fmemopen; returns the number of tokens (excluding
+// the final EOS). This is the baseline the structural region, which
+// in-memory inputs are scanned with, is measured against.
+//
+static long scan_region(char* data, size_t length)
+{
+  if (length == 0)
+    return 0;
+
+  FILE* input = fmemopen(data, length, "r");
+  if (input == NULL) panic("unable to open memory stream (scan_region)");
+
+  int lineNumber, colNumber;
+  char value[SCANNER_MAX_VALUE];
+  long tokens = 0;
+
+  scanner_init(&lineNumber, &colNumber, value);
+
+  struct Token T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+
+  while (T.id != nuPy_EOS)
+  {
+    tokens++;
+
+    T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+  }
+
+  fclose(input);
+
+  return tokens;
+}
+
+
+//
+// structural_region
+//
+// Scans the input with the two-stage structural scanner into a token
+// array that is reused across calls; returns the number of tokens
+// (excluding the final EOS).
+//
+static long structural_region(char* data, size_t length)
+{
+  static struct TokenArray* A = NULL;
+
+  if (A == NULL)
+    A = tokenarray_create();
+
+  tokenarray_reset(A);
+  structscan_scan(A, data, length);
+
+  return A->count - 1;
+}
+
+
+static struct BenchRegion Regions[] =
+{
+  { "scanner",    scan_region },
+  { "structural", structural_region }
+};
+
+
+//
+// read_input
+//
+// Reads the given file into memory; returns false if it can't be read.
+//
+static bool read_input(char* filename, struct Input* I)
+{
+  struct stat st;
+
+  if (stat(filename, &st) < 0 || !S_ISREG(st.st_mode))
+    return false;
+
+  FILE* input = fopen(filename, "rb");
+  if (input == NULL)
+    return false;
+
+  I->data = (char*)allocMemory((size_t)st.st_size + 1);
+  if (I->data == NULL) panic("out of memory (read_input)");
+
+  I->length = fread(I->data, 1, (size_t)st.st_size, input);
+  fclose(input);
+
+  return true;
+}
+
+
+//
+// bench_region
+//
+// Runs the region over every input, repeats times, and outputs the
+// timings (and counters, if P is not NULL).
+//
+static void bench_region(struct BenchRegion* region, struct Input* inputs, int count, int repeats, struct PerfCounters* P)
+{
+  size_t bytes = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    region->run(inputs[i].data, inputs[i].length);  // warm up
+    bytes += inputs[i].length;
+  }
+
+  struct PerfSample sample;
+  struct timespec start, stop;
+  long tokens = 0;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  if (P != NULL)
+    perf_start(P);
+
+  for (int r = 0; r < repeats; r++)
+  {
+    for (int i = 0; i < count; i++)
+      tokens += region->run(inputs[i].data, inputs[i].length);
+  }
+
+  if (P != NULL)
+    perf_stop(P, &sample);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  double secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+  double totalBytes = (double)bytes * repeats;
+
+  printf("**BENCH %s: %d files, %zu bytes x %d runs, %ld tokens, %.3f ms, %.2f MB/s, %.1f ns/token\n",
+    region->label, count, bytes, repeats, tokens, secs * 1000.0,
+    (secs > 0) ? totalBytes / secs / 1e6 : 0.0,
+    (tokens > 0) ? secs * 1e9 / tokens : 0.0);
+
+  if (P != NULL)
+    perf_report(region->label, &sample, totalBytes, (double)tokens);
+}
+
+
+//
+// bench_run
+//
+// Benchmarks the scanner over the given files; see bench.h.
+//
+int bench_run(char** files, int fileCount, int repeats, bool perf)
+{
+  if (repeats < 1)
+    repeats = 1;
+
+  struct Input* inputs = (struct Input*)allocMemory(sizeof(struct Input) * ((size_t)fileCount + 1));
+  if (inputs == NULL) panic("out of memory (bench_run)");
+
+  int count = 0;
+  int failed = 0;
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    if (read_input(files[f], &inputs[count]))
+      count++;
+    else
+    {
+      printf("**ERROR: unable to open input file '%s' for input.\n", files[f]);
+      failed++;
+    }
+  }
+
+  struct PerfCounters* P = NULL;
+
+  if (perf)
+  {
+    const char* reason;
+
+    P = perf_open();
+
+    if (!perf_available(P, &reason))
+    {
+      printf("**PERF: hardware counters unavailable (%s)\n", reason);
+      perf_close(P);
+      P = NULL;
+    }
+  }
+
+  int regions = (int)(sizeof(Regions) / sizeof(Regions[0]));
+
+  for (int r = 0; r < regions; r++)
+    bench_region(&Regions[r], inputs, count, repeats, P);
+
+  perf_close(P);
+
+  for (int i = 0; i < count; i++)
+    freeMemory(inputs[i].data);
+
+  freeMemory(inputs);
+
+  return failed;
+}
+
+
+//
+// Rng
+//
+// A small deterministic generator, so every run benchmarks the same
+// programs.
+//
+struct Rng
+{
+  uint64_t state;
+};
+
+
+static int rng_next(struct Rng* R, int n)
+{
+  R->state = R->state * 6364136223846793005ULL + 1442695040888963407ULL;
+
+  return (int)((R->state >> 33) % (uint64_t)n);
+}
+
+
+//
+// Program
+//
+// A nuPython program and its Python equivalent, being generated.
+//
+struct Program
+{
+  FILE*  nupy;
+  FILE*  py;
+  char*  nupyData;
+  size_t nupyLength;
+  char*  pyData;
+  size_t pyLength;
+  long   bytes;  // written to nupy so far
+};
+
+
+//
+// emit_line
+//
+// Outputs the given line at the given depth to both programs (only the
+// nuPython one if pyToo is false).
+//
+static void emit_line(struct Program* P, int depth, bool pyToo, char* line)
+{
+  P->bytes += fprintf(P->nupy, "%*s%s\n", 2 * depth, "", line);
+
+  if (pyToo)
+    fprintf(P->py, "%*s%s\n", 2 * depth, "", line);
+}
+
+
+static char* Ops[] = { "+", "-", "*", "/", "%", "**", "==", "!=", "<", "<=", ">", ">=" };
+
+//
+// gen_operand
+//
+// Formats a random identifier or literal into buffer.
+//
+static void gen_operand(struct Rng* R, char* buffer, size_t size)
+{
+  switch (rng_next(R, 3))
+  {
+    case 0:
+      snprintf(buffer, size, "v%d", rng_next(R, 1000));
+      break;
+    case 1:
+      snprintf(buffer, size, "%d", rng_next(R, 100000));
+      break;
+    default:
+      snprintf(buffer, size, "%d.%d", rng_next(R, 1000), rng_next(R, 100));
+      break;
+  }
+}
+
+
+//
+// gen_assignment
+//
+// Outputs "vN = a op b" (or a call) at the given depth.
+//
+static void gen_assignment(struct Program* P, struct Rng* R, int depth)
+{
+  char a[32], b[32], line[128];
+
+  gen_operand(R, a, sizeof(a));
+  gen_operand(R, b, sizeof(b));
+
+  if (rng_next(R, 8) == 0)
+    snprintf(line, sizeof(line), "print(%s)", a);
+  else
+    snprintf(line, sizeof(line), "v%d = %s %s %s", rng_next(R, 1000), a, Ops[rng_next(R, 12)], b);
+
+  emit_line(P, depth, true, line);
+}
+
+
+static void gen_expressions(struct Program* P, struct Rng* R)
+{
+  gen_assignment(P, R, 0);
+}
+
+
+static char* Words[] = { "lorem", "ipsum", "dolor", "sit", "amet", "nuPython", "scanner", "token", "42", "3.14" };
+
+static void gen_strings(struct Program* P, struct Rng* R)
+{
+  char text[160] = "";
+  char line[200];
+  int words = 1 + rng_next(R, 12);
+
+  for (int w = 0; w < words; w++)
+  {
+    strcat(text, Words[rng_next(R, 10)]);
+    strcat(text, " ");
+  }
+
+  char quote = rng_next(R, 2) ? '"' : '\'';
+
+  if (rng_next(R, 4) == 0)
+    snprintf(line, sizeof(line), "print(%c%s%c)", quote, text, quote);
+  else
+    snprintf(line, sizeof(line), "s%d = %c%s%c", rng_next(R, 1000), quote, text, quote);
+
+  emit_line(P, 0, true, line);
+}
+
+
+//
+// gen_block
+//
+// Outputs an if/elif/else or while statement whose bodies hold a few
+// statements, nesting up to 3 deep. nuPython bodies are braced, Python
+// bodies are indented.
+//
+static void gen_block(struct Program* P, struct Rng* R, int depth);
+
+static void gen_body(struct Program* P, struct Rng* R, int depth)
+{
+  emit_line(P, depth, false, "{");
+
+  int stmts = 1 + rng_next(R, 3);
+
+  for (int s = 0; s < stmts; s++)
+  {
+    if (depth < 3 && rng_next(R, 3) == 0)
+      gen_block(P, R, depth + 1);
+    else if (rng_next(R, 6) == 0)
+      emit_line(P, depth + 1, true, "pass");
+    else
+      gen_assignment(P, R, depth + 1);
+  }
+
+  emit_line(P, depth, false, "}");
+}
+
+static void gen_block(struct Program* P, struct Rng* R, int depth)
+{
+  char a[32], b[32], line[128];
+
+  gen_operand(R, a, sizeof(a));
+  gen_operand(R, b, sizeof(b));
+
+  if (rng_next(R, 3) == 0)
+  {
+    snprintf(line, sizeof(line), "while %s %s %s:", a, Ops[6 + rng_next(R, 6)], b);
+    emit_line(P, depth, true, line);
+    gen_body(P, R, depth);
+    return;
+  }
+
+  snprintf(line, sizeof(line), "if %s %s %s:", a, Ops[6 + rng_next(R, 6)], b);
+  emit_line(P, depth, true, line);
+  gen_body(P, R, depth);
+
+  if (rng_next(R, 2) == 0)
+  {
+    snprintf(line, sizeof(line), "elif %s:", a);
+    emit_line(P, depth, true, line);
+    gen_body(P, R, depth);
+  }
+
+  if (rng_next(R, 2) == 0)
+  {
+    emit_line(P, depth, true, "else:");
+    gen_body(P, R, depth);
+  }
+}
+
+static void gen_control(struct Program* P, struct Rng* R)
+{
+  gen_block(P, R, 0);
+}
+
+
+static void gen_comments(struct Program* P, struct Rng* R)
+{
+  char line[200] = "#";
+  int words = 1 + rng_next(R, 15);
+
+  for (int w = 0; w < words; w++)
+  {
+    strcat(line, " ");
+    strcat(line, Words[rng_next(R, 10)]);
+  }
+
+  emit_line(P, 0, true, line);
+
+  if (rng_next(R, 4) == 0)
+    gen_assignment(P, R, 0);
+}
+
+
+//
+// InputClass
+//
+// A class of synthetic input: generate() outputs one more unit (a
+// statement or so) of the program.
+//
+struct InputClass
+{
+  char* name;
+  void  (*generate)(struct Program* P, struct Rng* R);
+};
+
+static struct InputClass Classes[] =
+{
+  { "expressions", gen_expressions },
+  { "strings",     gen_strings },
+  { "control",     gen_control },
+  { "comments",    gen_comments }
+};
+
+
+//
+// generate_program
+//
+// Generates about kilobytes KB of nuPython of the given class, along
+// with its Python equivalent; free both buffers when done.
+//
+static void generate_program(struct InputClass* C, int kilobytes, struct Program* P)
+{
+  struct Rng R = { 211 };
+
+  P->nupy = open_memstream(&P->nupyData, &P->nupyLength);
+  P->py = open_memstream(&P->pyData, &P->pyLength);
+  P->bytes = 0;
+
+  if (P->nupy == NULL || P->py == NULL)
+    panic("unable to open memory stream (generate_program)");
+
+  while (P->bytes < (long)kilobytes * 1024)
+    C->generate(P, &R);
+
+  fclose(P->nupy);
+  fclose(P->py);
+}
+
+
+//
+// time_python
+//
+// Writes the Python program to a temporary file and times tokenize and
+// ast.parse over it repeats times inside python3; returns false if
+// python3 couldn't be run.
+//
+static bool time_python(struct Program* P, int repeats, double* tokenizeSecs, double* parseSecs)
+{
+  char path[] = "/tmp/nupy-bench-XXXXXX";
+  int fd = mkstemp(path);
+
+  if (fd < 0)
+    return false;
+
+  FILE* output = fdopen(fd, "w");
+  if (output == NULL)
+  {
+    close(fd);
+    unlink(path);
+    return false;
+  }
+
+  fwrite(P->pyData, 1, P->pyLength, output);
+  fclose(output);
+
+  char command[1024];
+
+  snprintf(command, sizeof(command),
+    "python3 -c '"
+    "import ast, io, sys, time, tokenize\n"
+    "src = open(sys.argv[1]).read()\n"
+    "n = int(sys.argv[2])\n"
+    "ast.parse(src)\n"
+    "t0 = time.perf_counter()\n"
+    "for _ in range(n):\n"
+    "  for _ in tokenize.generate_tokens(io.StringIO(src).readline): pass\n"
+    "t1 = time.perf_counter()\n"
+    "for _ in range(n): ast.parse(src)\n"
+    "t2 = time.perf_counter()\n"
+    "print(t1 - t0, t2 - t1)\n"
+    "' %s %d 2>/dev/null", path, repeats);
+
+  FILE* python = popen(command, "r");
+  bool ok = false;
+
+  if (python != NULL)
+  {
+    ok = (fscanf(python, "%lf %lf", tokenizeSecs, parseSecs) == 2);
+
+    if (pclose(python) != 0)
+      ok = false;
+  }
+
+  unlink(path);
+
+  return ok;
+}
+
+
+//
+// bench_compare
+//
+// Compares the scanner against CPython's tokenize and ast.parse; see
+// bench.h.
+//
+int bench_compare(int kilobytes, int repeats)
+{
+  if (kilobytes < 1)
+    kilobytes = 1;
+  if (repeats < 1)
+    repeats = 1;
+
+  bool python = (system("python3 -c pass >/dev/null 2>&1") == 0);
+
+  if (!python)
+    printf("**COMPARE: python3 not found, timing nuPython only\n");
+
+  int classes = (int)(sizeof(Classes) / sizeof(Classes[0]));
+
+  for (int c = 0; c < classes; c++)
+  {
+    struct Program P;
+
+    generate_program(&Classes[c], kilobytes, &P);
+
+    //
+    // time the scanner on the nuPython program (in memory, so the
+    // structural scanner):
+    //
+    struct timespec start, stop;
+    long tokens = structural_region(P.nupyData, P.nupyLength);  // warm up
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int r = 0; r < repeats; r++)
+      structural_region(P.nupyData, P.nupyLength);
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double scanSecs = ((stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9) / repeats;
+    double scanRate = P.nupyLength / scanSecs / 1e6;
+
+    double tokenizeSecs, parseSecs;
+
+    if (python && time_python(&P, repeats, &tokenizeSecs, &parseSecs))
+    {
+      tokenizeSecs /= repeats;
+      parseSecs /= repeats;
+
+      // the programs are equivalent, so compare the time per program:
+      printf("**COMPARE %s: %zu bytes, %ld tokens; nuPython scan %.2f MB/s; "
+             "python tokenize %.2f MB/s (%.1fx), ast.parse %.2f MB/s (%.1fx)\n",
+        Classes[c].name, P.nupyLength, tokens, scanRate,
+        P.pyLength / tokenizeSecs / 1e6, tokenizeSecs / scanSecs,
+        P.pyLength / parseSecs / 1e6, parseSecs / scanSecs);
+    }
+    else
+    {
+      if (python)
+        printf("**COMPARE %s: python3 failed on the generated program, skipped\n", Classes[c].name);
+
+      printf("**COMPARE %s: %zu bytes, %ld tokens; nuPython scan %.2f MB/s\n",
+        Classes[c].name, P.nupyLength, tokens, scanRate);
+    }
+
+    free(P.nupyData);  // allocated by open_memstream
+    free(P.pyData);
+  }
+
+  return 0;
+}
@@ -0,0 +1,45 @@
+/*bench.h*/
+
+#pragma once
+
+#include <stdbool.h>  // bool
+
+
+//
+// bench_run
+//
+// Benchmarks the scanners over the given files: each file is read into
+// memory once, then scanned "repeats" times (after one unmeasured
+// warm-up pass) by each region, scanner_nextToken ("scanner") and
+// structscan_scan ("structural"), and the throughput is output as
+//
+//   **BENCH region: ... MB/s, ... ns/token
+//
+// If perf is true, the measured region is also wrapped with hardware
+// performance counters (see perfcount.h) and cycles, instructions,
+// IPC, branch misses and L1/LLC misses are output per byte and per
+// token; if the counters are unavailable, the reason is output instead
+// and the wall-clock numbers are still reported.
+//
+// Returns the number of files that could not be read.
+//
+int bench_run(char** files, int fileCount, int repeats, bool perf);
+
+//
+// bench_compare
+//
+// Compares the scanner against CPython. For each class of input
+// (expressions, strings, control flow, comments) a synthetic nuPython
+// program of about the given size is generated along with an
+// equivalent Python program (indentation in place of braces). The
+// time of the in-memory (structural) scanner on the nuPython program
+// is compared to the time of CPython's tokenize and ast.parse on the
+// Python one, measured inside python3 so interpreter startup is
+// excluded, and output as
+//
+//   **COMPARE class: ... MB/s nuPython scan, ... MB/s tokenize (...x), ...
+//
+// If python3 can't be run, only the scanner is timed and the
+// comparison is skipped. Returns 0.
+//
+int bench_compare(int kilobytes, int repeats);
@@ -0,0 +1,251 @@
+/*cache.c*/
+
+//
+// LRU cache of request results. Entries are found through a chained
+// hash table on the path and kept on a doubly-linked list in order of
+// use, most recent first, so both lookup and eviction are O(1).
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>  // true, false
+#include <string.h>   // strcmp, strlen, memcpy
+
+#include "util.h"
+#include "cache.h"
+
+
+#define BUCKETS 1024
+
+
+struct Entry
+{
+  char*         path;
+  int64_t       size;
+  int64_t       mtime;
+  uint64_t      hash;
+  char*         result;
+  size_t        length;
+  size_t        bytes;     // charged against the budget
+
+  struct Entry* chain;     // next in hash bucket
+  struct Entry* newer;     // LRU list neighbors
+  struct Entry* older;
+};
+
+struct ResultCache
+{
+  struct Entry* buckets[BUCKETS];
+  struct Entry* newest;
+  struct Entry* oldest;
+
+  size_t        budget;
+  size_t        bytes;
+
+  long          hits;
+  long          misses;
+  long          evictions;
+};
+
+
+//
+// cache_create
+//
+// Creates an empty cache with the given byte budget.
+//
+struct ResultCache* cache_create(size_t byteBudget)
+{
+  struct ResultCache* C = (struct ResultCache*)callocMemory(1, sizeof(struct ResultCache));
+  if (C == NULL) panic("out of memory (cache_create)");
+
+  C->budget = byteBudget;
+
+  return C;
+}
+
+
+static struct Entry** bucket_of(struct ResultCache* C, char* path)
+{
+  return &C->buckets[hashBytes(path, strlen(path)) % BUCKETS];
+}
+
+
+//
+// unlink_lru
+//
+// Removes the entry from the LRU list.
+//
+static void unlink_lru(struct ResultCache* C, struct Entry* E)
+{
+  if (E->newer != NULL) E->newer->older = E->older; else C->newest = E->older;
+  if (E->older != NULL) E->older->newer = E->newer; else C->oldest = E->newer;
+
+  E->newer = NULL;
+  E->older = NULL;
+}
+
+
+//
+// push_newest
+//
+// Puts the entry at the front (most recently used end) of the list.
+//
+static void push_newest(struct ResultCache* C, struct Entry* E)
+{
+  E->newer = NULL;
+  E->older = C->newest;
+
+  if (C->newest != NULL)
+    C->newest->newer = E;
+  else
+    C->oldest = E;
+
+  C->newest = E;
+}
+
+
+//
+// remove_entry
+//
+// Unlinks the entry from the table and the list, and frees it.
+//
+static void remove_entry(struct ResultCache* C, struct Entry* E)
+{
+  struct Entry** link = bucket_of(C, E->path);
+
+  while (*link != E)
+    link = &(*link)->chain;
+
+  *link = E->chain;
+
+  unlink_lru(C, E);
+
+  C->bytes -= E->bytes;
+
+  freeMemory(E->path);
+  freeMemory(E->result);
+  freeMemory(E);
+}
+
+
+//
+// cache_destroy
+//
+// Frees the cache and every cached result.
+//
+void cache_destroy(struct ResultCache* C)
+{
+  if (C == NULL)
+    return;
+
+  while (C->oldest != NULL)
+    remove_entry(C, C->oldest);
+
+  freeMemory(C);
+}
+
+
+static struct Entry* find(struct ResultCache* C, char* path)
+{
+  for (struct Entry* E = *bucket_of(C, path); E != NULL; E = E->chain)
+  {
+    if (strcmp(E->path, path) == 0)
+      return E;
+  }
+
+  return NULL;
+}
+
+
+//
+// cache_lookup
+//
+// Returns the cached result if it is still valid for the file, else NULL.
+//
+char* cache_lookup(struct ResultCache* C, char* path, int64_t size, int64_t mtime, uint64_t hash, size_t* length)
+{
+  struct Entry* E = find(C, path);
+
+  if (E == NULL)
+  {
+    C->misses++;
+    return NULL;
+  }
+
+  if (E->size != size || E->mtime != mtime || E->hash != hash)  // stale
+  {
+    remove_entry(C, E);
+    C->misses++;
+    return NULL;
+  }
+
+  unlink_lru(C, E);
+  push_newest(C, E);
+
+  C->hits++;
+  *length = E->length;
+
+  return E->result;
+}
+
+
+//
+// cache_insert
+//
+// Caches a copy of the result, evicting the least recently used
+// entries until it fits within the budget.
+//
+void cache_insert(struct ResultCache* C, char* path, int64_t size, int64_t mtime, uint64_t hash, char* result, size_t length)
+{
+  size_t bytes = sizeof(struct Entry) + strlen(path) + 1 + length;
+
+  if (bytes > C->budget)
+    return;
+
+  struct Entry* old = find(C, path);
+  if (old != NULL)
+    remove_entry(C, old);
+
+  while (C->bytes + bytes > C->budget)
+  {
+    remove_entry(C, C->oldest);
+    C->evictions++;
+  }
+
+  struct Entry* E = (struct Entry*)allocMemory(sizeof(struct Entry));
+  char* copy = (char*)allocMemory(length + 1);
+  if (E == NULL || copy == NULL) panic("out of memory (cache_insert)");
+
+  memcpy(copy, result, length);
+  copy[length] = '\0';
+
+  E->path = dupString(path);
+  E->size = size;
+  E->mtime = mtime;
+  E->hash = hash;
+  E->result = copy;
+  E->length = length;
+  E->bytes = bytes;
+
+  struct Entry** bucket = bucket_of(C, path);
+  E->chain = *bucket;
+  *bucket = E;
+
+  push_newest(C, E);
+  C->bytes += bytes;
+}
+
+
+//
+// cache_report
+//
+// Outputs the cache counters.
+//
+void cache_report(struct ResultCache* C)
+{
+  long lookups = C->hits + C->misses;
+  double rate = (lookups == 0) ? 0.0 : 100.0 * C->hits / lookups;
+
+  printf("**CACHE: %ld hits, %ld misses (%.1f%% hit rate), %ld evictions, %zu of %zu bytes in use\n",
+    C->hits, C->misses, rate, C->evictions, C->bytes, C->budget);
+}
@@ -0,0 +1,59 @@
+/*cache.h*/
+
+#pragma once
+
+#include <stddef.h>  // size_t
+#include <stdint.h>  // int64_t, uint64_t
+
+
+//
+// ResultCache
+//
+// An in-memory LRU cache of request results (the complete output of
+// processing a file), keyed by path and validated by the file's size,
+// mtime and content hash. The cache holds at most byteBudget bytes of
+// results; the least recently used entries are evicted to make room.
+//
+struct ResultCache;
+
+
+//
+// cache_create
+//
+// Creates an empty cache with the given byte budget.
+//
+struct ResultCache* cache_create(size_t byteBudget);
+
+//
+// cache_destroy
+//
+// Frees the cache and every cached result.
+//
+void cache_destroy(struct ResultCache* C);
+
+//
+// cache_lookup
+//
+// Returns the cached result for the path if it was cached for the
+// same size, mtime and content hash, and marks it most recently used;
+// its length is returned via length. Returns NULL on a miss (and drops
+// any stale entry for the path). The result is owned by the cache and
+// is valid until the next insert.
+//
+char* cache_lookup(struct ResultCache* C, char* path, int64_t size, int64_t mtime, uint64_t hash, size_t* length);
+
+//
+// cache_insert
+//
+// Caches a copy of the given result for the path, evicting least
+// recently used entries as needed. A result larger than the whole
+// budget is not cached.
+//
+void cache_insert(struct ResultCache* C, char* path, int64_t size, int64_t mtime, uint64_t hash, char* result, size_t length);
+
+//
+// cache_report
+//
+// Outputs the hit, miss and eviction counters and the bytes in use.
+//
+void cache_report(struct ResultCache* C);
@@ -0,0 +1,104 @@
+/*cancel.c*/
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdbool.h>  // true, false
+#include <time.h>     // clock_gettime
+
+#include "cancel.h"
+
+
+//
+// now_ms
+//
+// Returns a monotonic timestamp in milliseconds.
+//
+static double now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+
+//
+// cancel_init
+//
+// Initializes the token: not cancelled, no deadline.
+//
+void cancel_init(struct CancelToken* C)
+{
+  atomic_init(&C->cancelled, false);
+  C->deadline = 0;
+  C->polls = 0;
+}
+
+
+//
+// cancel_request
+//
+// Cancels the token.
+//
+void cancel_request(struct CancelToken* C)
+{
+  atomic_store(&C->cancelled, true);
+}
+
+
+//
+// cancel_setTimeout
+//
+// Sets the deadline to the given number of milliseconds from now.
+//
+void cancel_setTimeout(struct CancelToken* C, double ms)
+{
+  C->deadline = (ms > 0) ? now_ms() + ms : 0;
+}
+
+
+//
+// cancel_check
+//
+// Returns true if the token has been cancelled or its deadline has
+// passed; once the deadline passes the token stays cancelled.
+//
+bool cancel_check(struct CancelToken* C)
+{
+  if (C == NULL)
+    return false;
+
+  if (atomic_load_explicit(&C->cancelled, memory_order_relaxed))
+    return true;
+
+  if (C->deadline > 0 && now_ms() >= C->deadline)
+  {
+    cancel_request(C);
+    return true;
+  }
+
+  return false;
+}
+
+
+//
+// cancel_poll
+//
+// Like cancel_check, but only checks every CANCEL_CHECK_INTERVAL calls.
+//
+bool cancel_poll(struct CancelToken* C)
+{
+  if (C == NULL)
+    return false;
+
+  C->polls++;
+
+  if (C->polls < CANCEL_CHECK_INTERVAL)
+    return false;
+
+  C->polls = 0;
+
+  return cancel_check(C);
+}
@@ -0,0 +1,65 @@
+/*cancel.h*/
+
+#pragma once
+
+#include <stdbool.h>    // true, false
+#include <stdatomic.h>
+
+
+//
+// CancelToken
+//
+// Cooperative cancellation for long-running scans and parses. Another
+// thread (or a signal handler) may cancel the token at any time, and
+// an optional deadline cancels it automatically. Loops that drive the
+// scanner call cancel_poll once per token; the token is only actually
+// checked every CANCEL_CHECK_INTERVAL calls, so polling is cheap.
+//
+#define CANCEL_CHECK_INTERVAL 1024
+
+struct CancelToken
+{
+  atomic_bool cancelled;
+  double      deadline;   // monotonic ms, or 0 for no deadline
+  int         polls;      // calls to cancel_poll since the last check
+};
+
+
+//
+// cancel_init
+//
+// Initializes the token: not cancelled, no deadline.
+//
+void cancel_init(struct CancelToken* C);
+
+//
+// cancel_request
+//
+// Cancels the token. Safe to call from any thread or a signal handler.
+//
+void cancel_request(struct CancelToken* C);
+
+//
+// cancel_setTimeout
+//
+// Sets the deadline to the given number of milliseconds from now;
+// a timeout <= 0 removes the deadline.
+//
+void cancel_setTimeout(struct CancelToken* C, double ms);
+
+//
+// cancel_check
+//
+// Returns true if the token has been cancelled or its deadline has
+// passed. A NULL token is never cancelled.
+//
+bool cancel_check(struct CancelToken* C);
+
+//
+// cancel_poll
+//
+// Like cancel_check, but only checks every CANCEL_CHECK_INTERVAL
+// calls (returning false in between); use it in per-token loops. The
+// token must be polled by one thread only.
+//
+bool cancel_poll(struct CancelToken* C);
@@ -0,0 +1,344 @@
+/*flightrec.c*/
+
+//
+// Flight recorder: a fixed-size ring of recent events per thread,
+// cheap enough to leave on in production and dumped when something
+// goes wrong. Time is read from the TSC where there is one (a few
+// cycles) and converted to nanoseconds only when dumped.
+//
+// A thread's ring is allocated on its first event, so threads cost
+// nothing while the recorder is off, along with an alternate signal
+// stack: a stack overflow is the crash most worth a dump, and its
+// handler can't run on the overflowed stack. Both are freed when the
+// thread exits.
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>   // true, false
+#include <stdint.h>    // uint64_t, uint32_t
+#include <string.h>    // memset, strlen
+#include <signal.h>    // sigaction, raise
+#include <time.h>      // clock_gettime
+#include <unistd.h>    // write
+#include <pthread.h>   // pthread_key_create, pthread_setspecific
+
+#if defined(__has_include) && (defined(__x86_64__) || defined(__i386__))
+#if __has_include(<x86intrin.h>)
+#define HAVE_RDTSC 1
+#include <x86intrin.h>  // __rdtsc
+#endif
+#endif
+
+#include "util.h"
+#include "flightrec.h"
+
+
+#define ALT_STACK_BYTES (64*1024)  // for the signal handlers
+
+
+//
+// FlightEntry
+//
+// One event; delta is in ticks since the thread's previous event
+// (saturating).
+//
+struct FlightEntry
+{
+  int      line;
+  int      col;
+  int      id;
+  uint32_t delta;
+};
+
+//
+// FlightRing
+//
+// A thread's ring: entry i is at entries[i % FLIGHTREC_ENTRIES], and
+// the thread's alternate signal stack.
+//
+struct FlightRing
+{
+  struct FlightEntry entries[FLIGHTREC_ENTRIES];
+  uint64_t           count;  // events ever recorded
+  uint64_t           last;   // ticks at the last one
+  char               altStack[ALT_STACK_BYTES];
+};
+
+
+static bool          Enabled = false;
+static double        TicksPerNs = 1.0;
+static pthread_key_t RingKey;  // frees a thread's ring when it exits
+
+static _Thread_local struct FlightRing* Ring = NULL;
+
+
+//
+// ticks
+//
+// Returns the current time in ticks: TSC cycles, or nanoseconds.
+//
+static inline uint64_t ticks(void)
+{
+#if HAVE_RDTSC
+  return __rdtsc();
+#else
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+
+//
+// free_ring
+//
+// Thread-exit destructor: switches the signal handlers back to the
+// thread's stack, then frees the ring and the stack with it.
+//
+static void free_ring(void* ring)
+{
+  stack_t ss;
+
+  memset(&ss, 0, sizeof(ss));
+  ss.ss_flags = SS_DISABLE;
+  sigaltstack(&ss, NULL);
+
+  Ring = NULL;
+  freeMemory(ring);
+}
+
+
+//
+// create_ring
+//
+// Allocates the calling thread's ring and installs its alternate
+// signal stack; returns NULL if out of memory (the event is dropped).
+//
+static struct FlightRing* create_ring(void)
+{
+  struct FlightRing* ring = (struct FlightRing*)allocMemory(sizeof(struct FlightRing));
+  if (ring == NULL)
+    return NULL;
+
+  ring->count = 0;
+  ring->last = 0;
+
+  stack_t ss;
+
+  memset(&ss, 0, sizeof(ss));
+  ss.ss_sp = ring->altStack;
+  ss.ss_size = sizeof(ring->altStack);
+  sigaltstack(&ss, NULL);
+
+  pthread_setspecific(RingKey, ring);
+
+  Ring = ring;  // last, so a signal never sees it half set up
+
+  return ring;
+}
+
+
+//
+// flightrec_record
+//
+// Appends to the calling thread's ring, creating it on first use.
+//
+void flightrec_record(int line, int col, int id)
+{
+  if (!Enabled)
+    return;
+
+  struct FlightRing* ring = Ring;
+
+  if (ring == NULL && (ring = create_ring()) == NULL)
+    return;
+
+  uint64_t now = ticks();
+  uint64_t delta = (ring->count == 0) ? 0 : now - ring->last;
+  struct FlightEntry* E = &ring->entries[ring->count & (FLIGHTREC_ENTRIES - 1)];
+
+  E->line = line;
+  E->col = col;
+  E->id = id;
+  E->delta = (delta > UINT32_MAX) ? UINT32_MAX : (uint32_t)delta;
+
+  ring->last = now;
+  ring->count++;  // last, so a signal mid-record skips the entry
+}
+
+
+//
+// append_str, append_int
+//
+// Async-signal-safe formatting into a fixed buffer (no printf).
+//
+static int append_str(char* buf, int n, const char* s)
+{
+  while (*s != '\0' && n < 255)
+    buf[n++] = *s++;
+
+  return n;
+}
+
+static int append_int(char* buf, int n, long long v)
+{
+  char digits[24];
+  int d = 0;
+  unsigned long long u = (v < 0) ? 0ULL - (unsigned long long)v : (unsigned long long)v;
+
+  do
+  {
+    digits[d++] = (char)('0' + u % 10);
+    u /= 10;
+  } while (u > 0);
+
+  if (v < 0 && n < 255)
+    buf[n++] = '-';
+
+  while (d > 0 && n < 255)
+    buf[n++] = digits[--d];
+
+  return n;
+}
+
+
+//
+// flightrec_dump
+//
+// Writes the ring to stderr with write(), so it is safe in a signal
+// handler; see flightrec.h.
+//
+void flightrec_dump(char* reason)
+{
+  if (!Enabled)
+    return;
+
+  struct FlightRing* ring = Ring;
+  uint64_t count = (ring != NULL) ? ring->count : 0;
+  uint64_t first = (count > FLIGHTREC_ENTRIES) ? count - FLIGHTREC_ENTRIES : 0;
+  char buf[256];
+  int n = 0;
+
+  n = append_str(buf, n, "**FLIGHT: ");
+  n = append_str(buf, n, reason);
+  n = append_str(buf, n, ", last ");
+  n = append_int(buf, n, (long long)(count - first));
+  n = append_str(buf, n, " of ");
+  n = append_int(buf, n, (long long)count);
+  n = append_str(buf, n, " events on this thread\n");
+
+  if (write(STDERR_FILENO, buf, (size_t)n) < 0)
+    return;
+
+  for (uint64_t i = first; i < count; i++)
+  {
+    struct FlightEntry* E = &ring->entries[i & (FLIGHTREC_ENTRIES - 1)];
+
+    n = 0;
+    n = append_str(buf, n, "**FLIGHT (");
+    n = append_int(buf, n, E->line);
+    n = append_str(buf, n, ", ");
+    n = append_int(buf, n, E->col);
+    n = append_str(buf, n, ") token ");
+    n = append_int(buf, n, E->id);
+    n = append_str(buf, n, " +");
+    n = append_int(buf, n, (long long)(E->delta / TicksPerNs));
+    n = append_str(buf, n, "ns\n");
+
+    if (write(STDERR_FILENO, buf, (size_t)n) < 0)
+      return;
+  }
+}
+
+
+//
+// on_signal
+//
+// Dumps the ring; a fatal signal is then re-raised with its default
+// action restored (SA_RESETHAND).
+//
+static void on_signal(int sig)
+{
+  switch (sig)
+  {
+    case SIGUSR1: flightrec_dump("SIGUSR1"); return;
+    case SIGSEGV: flightrec_dump("SIGSEGV"); break;
+    case SIGBUS:  flightrec_dump("SIGBUS"); break;
+    case SIGFPE:  flightrec_dump("SIGFPE"); break;
+    case SIGILL:  flightrec_dump("SIGILL"); break;
+    default:      flightrec_dump("SIGABRT"); break;
+  }
+
+  raise(sig);
+}
+
+
+//
+// calibrate
+//
+// Measures ticks per nanosecond against the monotonic clock.
+//
+static double calibrate(void)
+{
+#if HAVE_RDTSC
+  struct timespec start, now;
+  uint64_t t0 = ticks();
+  double ns;
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  do  // spin for 2ms
+  {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (now.tv_sec - start.tv_sec) * 1e9 + (now.tv_nsec - start.tv_nsec);
+  } while (ns < 2e6);
+
+  return (double)(ticks() - t0) / ns;
+#else
+  return 1.0;
+#endif
+}
+
+
+//
+// flightrec_start
+//
+// Calibrates the clock, sets up the calling thread's ring and installs
+// the signal handlers, which run on the alternate stacks.
+//
+void flightrec_start(void)
+{
+  if (Enabled)
+    return;
+
+  TicksPerNs = calibrate();
+
+  if (pthread_key_create(&RingKey, free_ring) != 0)
+    panic("unable to create thread key (flightrec_start)");
+
+  Enabled = true;
+
+  if (create_ring() == NULL)
+    panic("out of memory (flightrec_start)");
+
+  struct sigaction action;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = on_signal;
+  sigemptyset(&action.sa_mask);
+
+  action.sa_flags = SA_RESTART | SA_ONSTACK;
+  sigaction(SIGUSR1, &action, NULL);
+
+  action.sa_flags = SA_RESETHAND | SA_ONSTACK;
+  sigaction(SIGSEGV, &action, NULL);
+  sigaction(SIGBUS, &action, NULL);
+  sigaction(SIGFPE, &action, NULL);
+  sigaction(SIGILL, &action, NULL);
+  sigaction(SIGABRT, &action, NULL);
+}
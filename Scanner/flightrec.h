@@ -0,0 +1,49 @@
+/*flightrec.h*/
+
+#pragma once
+
+
+//
+// FLIGHTREC_ENTRIES
+//
+// Events kept per thread (a power of 2): the ring keeps the most
+// recent ones, overwriting the oldest.
+//
+#define FLIGHTREC_ENTRIES 4096
+
+
+//
+// flightrec_start
+//
+// Turns the flight recorder on for the rest of the process: from now
+// on every token scanned and statement parsed is recorded, with its
+// line, column, token id and the time since the previous event, in a
+// ring buffer per thread. The calling thread's ring is dumped to
+// stderr on a panic, on a fatal signal (SIGSEGV, SIGBUS, SIGFPE, SIGILL,
+// SIGABRT, after which the signal takes its default action) and on
+// SIGUSR1 (after which execution continues). A signal dumps the ring of
+// the thread that receives it. Each thread's ring (64KB, plus 64KB of
+// alternate signal stack so even a stack overflow is dumped) is only
+// allocated when the thread records its first event.
+//
+void flightrec_start(void);
+
+//
+// flightrec_record
+//
+// Records one event in the calling thread's ring; does nothing (but a
+// test) unless the recorder was started. Costs a few nanoseconds.
+//
+void flightrec_record(int line, int col, int id);
+
+//
+// flightrec_dump
+//
+// Outputs the calling thread's ring to stderr, oldest event first, as
+//
+//   **FLIGHT: reason, last N of M events on this thread
+//   **FLIGHT (line, col) token id +ns
+//
+// Async-signal-safe. Does nothing unless the recorder was started.
+//
+void flightrec_dump(char* reason);
@@ -0,0 +1,368 @@
+/*forkserver.c*/
+
+//
+// Pre-warmed fork server: the parent does all of the one-time setup,
+// then forks a copy-on-write child per request so that each request
+// skips process startup. Output comes back to the parent over a pipe.
+//
+// The parent can also keep an LRU cache of each file's output, keyed
+// by path and validated by size, mtime and content hash, so repeated
+// requests for an unchanged file are answered without forking.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>  // true, false
+#include <string.h>   // strcspn, strlen
+#include <time.h>     // clock_gettime
+#include <unistd.h>   // fork, pipe, dup2, read, execl
+#include <sys/wait.h> // waitpid
+#include <sys/stat.h> // stat
+
+#include "util.h"
+#include "cache.h"
+#include "metrics.h"
+#include "forkserver.h"
+
+
+//
+// Latencies
+//
+// A growable array of request latencies (in milliseconds).
+//
+struct Latencies
+{
+  double* ms;
+  int     count;
+  int     capacity;
+};
+
+
+//
+// Output
+//
+// A growable buffer holding a child's output.
+//
+struct Output
+{
+  char*  data;
+  size_t length;
+  size_t capacity;
+};
+
+
+//
+// now_ms
+//
+// Returns a monotonic timestamp in milliseconds.
+//
+static double now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+
+//
+// latencies_add
+//
+// Appends the given latency, growing the array as needed.
+//
+static void latencies_add(struct Latencies* L, double ms)
+{
+  if (L->count == L->capacity)
+  {
+    L->capacity = (L->capacity == 0) ? 64 : L->capacity * 2;
+    L->ms = (double*)reallocMemory(L->ms, sizeof(double) * L->capacity);
+    if (L->ms == NULL) panic("out of memory (latencies_add)");
+  }
+
+  L->ms[L->count] = ms;
+  L->count++;
+}
+
+
+static int compare_doubles(const void* a, const void* b)
+{
+  double x = *(const double*)a;
+  double y = *(const double*)b;
+
+  return (x > y) - (x < y);
+}
+
+
+//
+// latencies_report
+//
+// Sorts the latencies and outputs p50 and p99 under the given label.
+//
+static void latencies_report(char* label, struct Latencies* L)
+{
+  if (L->count == 0)
+    return;
+
+  qsort(L->ms, L->count, sizeof(double), compare_doubles);
+
+  double p50 = L->ms[(L->count - 1) * 50 / 100];
+  double p99 = L->ms[(L->count - 1) * 99 / 100];
+
+  printf("**%s: %d requests, p50 %.3f ms, p99 %.3f ms\n", label, L->count, p50, p99);
+}
+
+
+//
+// drain_pipe
+//
+// Reads the child's output until EOF, appending it to the given
+// buffer (or discarding it if output is NULL).
+//
+static void drain_pipe(int fd, struct Output* output)
+{
+  char buffer[4096];
+  ssize_t n;
+
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    if (output == NULL)
+      continue;
+
+    if (output->length + (size_t)n > output->capacity)
+    {
+      output->capacity = 2 * (output->length + (size_t)n);
+      output->data = (char*)reallocMemory(output->data, output->capacity);
+      if (output->data == NULL) panic("out of memory (drain_pipe)");
+    }
+
+    memcpy(output->data + output->length, buffer, (size_t)n);
+    output->length += (size_t)n;
+  }
+}
+
+
+//
+// hash_file
+//
+// Stats and hashes the given file for use as a cache key; returns
+// false if the file can't be read.
+//
+static bool hash_file(char* filename, int64_t* size, int64_t* mtime, uint64_t* hash)
+{
+  struct stat st;
+
+  if (stat(filename, &st) < 0 || !S_ISREG(st.st_mode))
+    return false;
+
+  FILE* input = fopen(filename, "rb");
+  if (input == NULL)
+    return false;
+
+  char* data = (char*)allocMemory((size_t)st.st_size + 1);
+  if (data == NULL) panic("out of memory (hash_file)");
+
+  size_t length = fread(data, 1, (size_t)st.st_size, input);
+  fclose(input);
+
+  *size = (int64_t)length;
+  *mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+  *hash = hashBytes(data, length);
+
+  freeMemory(data);
+
+  return true;
+}
+
+
+//
+// run_child
+//
+// Forks a child whose stdout is the write end of a pipe. The child
+// either calls process(filename) or, if coldExe is not NULL, execs
+// "coldExe filename". The parent drains the pipe into output (if not
+// NULL) and waits for the child. Returns true only if the child exited
+// with status 0; *forked is set to false if it couldn't be started.
+//
+static bool run_child(char* filename, int (*process)(char* filename), char* coldExe, struct Output* output, bool* forked)
+{
+  int fds[2];
+
+  *forked = false;
+
+  if (pipe(fds) < 0)
+    return false;
+
+  // anything still buffered would otherwise be output by the child too:
+  fflush(stdout);
+
+  pid_t pid = fork();
+
+  if (pid < 0)
+  {
+    close(fds[0]);
+    close(fds[1]);
+    return false;
+  }
+
+  if (pid == 0)  // child:
+  {
+    close(fds[0]);
+    dup2(fds[1], STDOUT_FILENO);
+    close(fds[1]);
+
+    if (coldExe != NULL)
+    {
+      execl(coldExe, coldExe, filename, (char*)NULL);
+      _exit(127);
+    }
+
+    int rc = process(filename);
+
+    fflush(stdout);
+    _exit(rc);
+  }
+
+  // parent:
+  *forked = true;
+
+  close(fds[1]);
+  drain_pipe(fds[0], output);
+  close(fds[0]);
+
+  int status;
+
+  if (waitpid(pid, &status, 0) < 0)
+    return false;
+
+  // a failed exec (127), a failed process() or a crash:
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+
+//
+// failures_report
+//
+// Outputs the number of runs under the given label that failed, and
+// so were left out of its latencies.
+//
+static void failures_report(char* label, int failed)
+{
+  if (failed > 0)
+    printf("**%s: %d requests failed (not timed)\n", label, failed);
+}
+
+
+//
+// forkserver_run
+//
+// Runs a pre-warmed fork server; see forkserver.h.
+//
+int forkserver_run(FILE* requests, int (*process)(char* filename), char* coldExe, size_t cacheBytes)
+{
+  if (requests == NULL || process == NULL)
+    panic("one or more parameters are NULL (forkserver_run)");
+
+  struct Latencies warm = { NULL, 0, 0 };  // forked, i.e. cache misses
+  struct Latencies hits = { NULL, 0, 0 };  // answered from the cache
+  struct Latencies cold = { NULL, 0, 0 };
+  struct Output output = { NULL, 0, 0 };
+  int warmFailed = 0, coldFailed = 0;
+
+  struct ResultCache* cache = (cacheBytes > 0) ? cache_create(cacheBytes) : NULL;
+
+  char filename[1024];
+
+  while (fgets(filename, sizeof(filename), requests) != NULL)
+  {
+    filename[strcspn(filename, "\r\n")] = '\0';
+
+    if (strlen(filename) == 0)  // blank line, ignore
+      continue;
+
+    double start = now_ms();
+
+    int64_t size = 0, mtime = 0;
+    uint64_t hash = 0;
+    bool cacheable = (cache != NULL) && hash_file(filename, &size, &mtime, &hash);
+
+    size_t length;
+    char* cached = cacheable ? cache_lookup(cache, filename, size, mtime, hash, &length) : NULL;
+
+    if (cacheable)
+      metrics_count((cached != NULL) ? METRIC_CACHE_HITS : METRIC_CACHE_MISSES, 1);
+
+    bool ok = true;
+
+    if (cached != NULL)  // hit, no need to fork:
+    {
+      fwrite(cached, 1, length, stdout);
+    }
+    else
+    {
+      bool forked;
+
+      output.length = 0;
+      ok = run_child(filename, process, NULL, &output, &forked);
+
+      if (!forked)
+      {
+        printf("**ERROR: unable to fork for request '%s'\n", filename);
+        return -1;
+      }
+
+      fwrite(output.data, 1, output.length, stdout);
+
+      if (ok && cacheable)  // a failure isn't worth keeping
+        cache_insert(cache, filename, size, mtime, hash, output.data, output.length);
+    }
+
+    double elapsed = now_ms() - start;
+
+    if (cached != NULL)
+      latencies_add(&hits, elapsed);
+    else if (ok)
+      latencies_add(&warm, elapsed);
+    else
+      warmFailed++;
+
+    metrics_count(METRIC_REQUESTS, 1);
+    metrics_observe(elapsed);
+
+    printf("**END %s (%.3f ms)\n", filename, elapsed);
+    fflush(stdout);
+
+    if (coldExe != NULL)
+    {
+      bool forked;
+
+      start = now_ms();
+
+      if (run_child(filename, process, coldExe, NULL, &forked))
+        latencies_add(&cold, now_ms() - start);
+      else
+        coldFailed++;
+    }
+  }
+
+  latencies_report("fork server", &warm);
+  failures_report("fork server", warmFailed);
+  latencies_report("cache hit", &hits);
+  latencies_report("cold exec", &cold);
+  failures_report("cold exec", coldFailed);
+
+  if (cache != NULL)
+  {
+    cache_report(cache);
+    cache_destroy(cache);
+  }
+
+  freeMemory(warm.ms);
+  freeMemory(hits.ms);
+  freeMemory(cold.ms);
+  freeMemory(output.data);
+
+  return 0;
+}
@@ -0,0 +1,38 @@
+/*forkserver.h*/
+
+#pragma once
+
+#include <stdio.h>
+#include <stddef.h>  // size_t
+
+
+//
+// forkserver_run
+//
+// Runs a pre-warmed fork server. The parent initializes once and
+// then reads one filename per line from the "requests" stream; for
+// each request a copy-on-write child is forked that calls process()
+// on the file with its stdout redirected into a pipe. The parent
+// copies the child's output to stdout, followed by a line of the
+// form "**END <filename> (<ms> ms)" so a client can frame responses.
+//
+// When the requests are exhausted, p50/p99 request latency is output.
+// If coldExe is not NULL, each request is also timed as a cold
+// fork+exec of "coldExe filename" and reported as a baseline. A child
+// that doesn't exit with status 0 (process() failed, the exec failed,
+// or it crashed) is left out of the latencies and counted as failed
+// instead; its output is passed on but not cached.
+//
+// If cacheBytes > 0, each file's output is kept in an LRU cache of at
+// most that many bytes, keyed by path and validated by size, mtime and
+// content hash; a request for an unchanged file is answered from the
+// cache without forking, and the cache counters are output at the end.
+// Hits are timed separately ("cache hit"), so the fork server's p50/p99
+// are those of the requests that forked, comparable with cold exec.
+//
+// If metrics_start has been called (see metrics.h), every request, its
+// latency and each cache hit or miss are also counted.
+//
+// Returns 0 on success, non-zero if the server could not run.
+//
+int forkserver_run(FILE* requests, int (*process)(char* filename), char* coldExe, size_t cacheBytes);
@@ -0,0 +1,610 @@
+/*index.c*/
+
+//
+// Cross-file identifier index: records (symbol, file, line, col) for
+// every identifier in a tree of nuPython files, and stores the result
+// as a sorted file that is mmap'd and binary-searched for lookups.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>   // true, false
+#include <string.h>    // strcmp, strlen, memcpy
+#include <dirent.h>    // opendir, readdir
+#include <fcntl.h>     // open
+#include <unistd.h>    // close
+#include <sys/mman.h>  // mmap, munmap
+#include <sys/stat.h>  // stat, lstat
+
+#include "util.h"
+#include "scanner.h"
+#include "index.h"
+
+
+//
+// MappedIndex
+//
+// An index file mapped read-only into memory.
+//
+struct MappedIndex
+{
+  void*                map;
+  size_t               length;
+  struct IndexHeader*  header;
+  struct IndexFile*    files;
+  struct IndexEntry*   entries;
+  char*                strings;
+};
+
+//
+// SourceFile / Ref
+//
+// In-memory form of the index while it is being built. Symbols point
+// either into a previous (mapped) index or to strings we own.
+//
+struct SourceFile
+{
+  char*   path;
+  int64_t mtime;
+  int64_t size;
+};
+
+struct Ref
+{
+  char* symbol;
+  int   file;
+  int   line;
+  int   col;
+};
+
+struct Builder
+{
+  struct SourceFile* files;
+  int                fileCount;
+  int                fileCapacity;
+
+  struct Ref*        refs;
+  int                refCount;
+  int                refCapacity;
+
+  char**             owned;     // symbols allocated while scanning
+  int                ownedCount;
+  int                ownedCapacity;
+};
+
+
+//
+// index_map
+//
+// Maps the given index file; returns false if it doesn't exist or
+// is not a valid index. Every offset and count in it is checked here,
+// so the lookups that follow can trust them.
+//
+static bool index_map(char* indexPath, struct MappedIndex* index)
+{
+  int fd = open(indexPath, O_RDONLY);
+  if (fd < 0)
+    return false;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct IndexHeader))
+  {
+    close(fd);
+    return false;
+  }
+
+  void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+    return false;
+
+  struct IndexHeader* header = (struct IndexHeader*)map;
+  size_t length = (size_t)st.st_size;
+
+  //
+  // every table must lie within the file; each offset is checked before
+  // the room after it, so a huge offset can't wrap around (the sizes
+  // can't, the counts being 32-bit):
+  //
+  bool ok = memcmp(header->magic, INDEX_MAGIC, 8) == 0 &&
+    header->filesOffset <= length &&
+    (uint64_t)header->fileCount * sizeof(struct IndexFile) <= length - header->filesOffset &&
+    header->entriesOffset <= length &&
+    (uint64_t)header->entryCount * sizeof(struct IndexEntry) <= length - header->entriesOffset &&
+    header->stringsOffset <= length &&
+    header->stringsLength <= length - header->stringsOffset &&
+    header->filesOffset % _Alignof(struct IndexFile) == 0 &&
+    header->entriesOffset % _Alignof(struct IndexEntry) == 0;
+
+  if (ok)
+  {
+    struct IndexFile* files = (struct IndexFile*)((char*)map + header->filesOffset);
+    struct IndexEntry* entries = (struct IndexEntry*)((char*)map + header->entriesOffset);
+    char* strings = (char*)map + header->stringsOffset;
+
+    //
+    // every string must start within the strings, which must end in
+    // '\0' so none runs past them, and every entry's file must exist:
+    //
+    if (header->fileCount > 0 || header->entryCount > 0)
+      ok = header->stringsLength > 0 && strings[header->stringsLength - 1] == '\0';
+
+    for (uint32_t i = 0; i < header->fileCount && ok; i++)
+      ok = files[i].path < header->stringsLength;
+
+    for (uint32_t i = 0; i < header->entryCount && ok; i++)
+      ok = entries[i].symbol < header->stringsLength && entries[i].file < header->fileCount;
+  }
+
+  if (!ok)
+  {
+    munmap(map, length);
+    return false;
+  }
+
+  index->map = map;
+  index->length = length;
+  index->header = header;
+  index->files = (struct IndexFile*)((char*)map + header->filesOffset);
+  index->entries = (struct IndexEntry*)((char*)map + header->entriesOffset);
+  index->strings = (char*)map + header->stringsOffset;
+
+  return true;
+}
+
+
+static void index_unmap(struct MappedIndex* index)
+{
+  munmap(index->map, index->length);
+}
+
+
+//
+// grow
+//
+// Doubles the capacity of a builder array when it is full.
+//
+static void* grow(void* array, int count, int* capacity, size_t elemSize)
+{
+  if (count < *capacity)
+    return array;
+
+  *capacity = (*capacity == 0) ? 256 : *capacity * 2;
+
+  array = reallocMemory(array, elemSize * (size_t)*capacity);
+  if (array == NULL) panic("out of memory (index grow)");
+
+  return array;
+}
+
+
+static void builder_addRef(struct Builder* B, char* symbol, int file, int line, int col)
+{
+  B->refs = (struct Ref*)grow(B->refs, B->refCount, &B->refCapacity, sizeof(struct Ref));
+
+  B->refs[B->refCount].symbol = symbol;
+  B->refs[B->refCount].file = file;
+  B->refs[B->refCount].line = line;
+  B->refs[B->refCount].col = col;
+  B->refCount++;
+}
+
+
+//
+// collect_files
+//
+// Recursively walks the directory, adding every .py file to the builder.
+// Symbolic links to files are followed, but not links to directories,
+// which could lead back up the tree and add the same files over and
+// over.
+//
+static void collect_files(struct Builder* B, char* directory)
+{
+  DIR* dir = opendir(directory);
+
+  if (dir == NULL)
+  {
+    printf("**WARNING: unable to open directory '%s'\n", directory);
+    return;
+  }
+
+  struct dirent* entry;
+
+  while ((entry = readdir(dir)) != NULL)
+  {
+    if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)
+      continue;
+
+    struct StringBuilder sb;
+
+    sbInit(&sb);
+    sbAppend(&sb, directory);
+    sbAppend(&sb, "/");
+    sbAppend(&sb, entry->d_name);
+
+    char* path = sbFinish(&sb);
+
+    struct stat st;
+
+    if (lstat(path, &st) < 0 || (S_ISLNK(st.st_mode) && (stat(path, &st) < 0 || S_ISDIR(st.st_mode))))
+    {
+      freeMemory(path);
+      continue;
+    }
+
+    if (S_ISDIR(st.st_mode))
+    {
+      collect_files(B, path);
+      freeMemory(path);
+      continue;
+    }
+
+    size_t L = strlen(path);
+
+    if (!S_ISREG(st.st_mode) || L < 3 || strcmp(path + L - 3, ".py") != 0)
+    {
+      freeMemory(path);
+      continue;
+    }
+
+    B->files = (struct SourceFile*)grow(B->files, B->fileCount, &B->fileCapacity, sizeof(struct SourceFile));
+
+    B->files[B->fileCount].path = path;
+    B->files[B->fileCount].mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+    B->files[B->fileCount].size = (int64_t)st.st_size;
+    B->fileCount++;
+  }
+
+  closedir(dir);
+}
+
+
+//
+// scan_file
+//
+// Scans the given file and adds a reference for every identifier.
+//
+static void scan_file(struct Builder* B, int file)
+{
+  FILE* input = fopen(B->files[file].path, "r");
+
+  if (input == NULL)
+  {
+    printf("**WARNING: unable to open input file '%s' for input.\n", B->files[file].path);
+    return;
+  }
+
+  int lineNumber, colNumber;
+  char value[SCANNER_MAX_VALUE];
+
+  scanner_init(&lineNumber, &colNumber, value);
+
+  struct Token T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+
+  while (T.id != nuPy_EOS)
+  {
+    if (T.id == nuPy_IDENTIFIER)
+    {
+      char* symbol = dupString(value);
+
+      B->owned = (char**)grow(B->owned, B->ownedCount, &B->ownedCapacity, sizeof(char*));
+      B->owned[B->ownedCount] = symbol;
+      B->ownedCount++;
+
+      builder_addRef(B, symbol, file, T.line, T.col);
+    }
+
+    T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+  }
+
+  fclose(input);
+}
+
+
+static int compare_files(const void* a, const void* b)
+{
+  return strcmp(((const struct SourceFile*)a)->path, ((const struct SourceFile*)b)->path);
+}
+
+static int compare_refs(const void* a, const void* b)
+{
+  const struct Ref* r1 = (const struct Ref*)a;
+  const struct Ref* r2 = (const struct Ref*)b;
+
+  int cmp = strcmp(r1->symbol, r2->symbol);
+  if (cmp != 0)
+    return cmp;
+
+  if (r1->file != r2->file)
+    return (r1->file < r2->file) ? -1 : 1;
+  if (r1->line != r2->line)
+    return (r1->line < r2->line) ? -1 : 1;
+
+  return (r1->col > r2->col) - (r1->col < r2->col);
+}
+
+
+//
+// find_old_file
+//
+// Binary search of the previous index's file table (sorted by path);
+// returns the file's position or -1 if not present.
+//
+static int find_old_file(struct MappedIndex* old, char* path)
+{
+  int lo = 0;
+  int hi = (int)old->header->fileCount - 1;
+
+  while (lo <= hi)
+  {
+    int mid = lo + (hi - lo) / 2;
+    int cmp = strcmp(old->strings + old->files[mid].path, path);
+
+    if (cmp == 0)
+      return mid;
+    else if (cmp < 0)
+      lo = mid + 1;
+    else
+      hi = mid - 1;
+  }
+
+  return -1;
+}
+
+
+//
+// write_index
+//
+// Writes the (sorted) builder contents to the given stream in the
+// on-disk format described in index.h. Returns false if the stream
+// can't be written, or if the paths and symbols don't fit in the 4GB
+// that 32-bit string offsets can address.
+//
+static bool write_index(struct Builder* B, FILE* output)
+{
+  struct IndexHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, INDEX_MAGIC, 8);
+
+  header.fileCount = (uint32_t)B->fileCount;
+  header.entryCount = (uint32_t)B->refCount;
+  header.filesOffset = sizeof(struct IndexHeader);
+  header.entriesOffset = header.filesOffset + sizeof(struct IndexFile) * (uint64_t)B->fileCount;
+  header.stringsOffset = header.entriesOffset + sizeof(struct IndexEntry) * (uint64_t)B->refCount;
+
+  //
+  // string offsets: paths first, then each distinct symbol once
+  // (refs are sorted, so equal symbols are adjacent):
+  //
+  uint64_t offset = 0;
+
+  struct IndexFile* files = (struct IndexFile*)callocMemory((size_t)B->fileCount + 1, sizeof(struct IndexFile));
+  struct IndexEntry* entries = (struct IndexEntry*)callocMemory((size_t)B->refCount + 1, sizeof(struct IndexEntry));
+  if (files == NULL || entries == NULL) panic("out of memory (write_index)");
+
+  for (int i = 0; i < B->fileCount; i++)
+  {
+    files[i].path = (uint32_t)offset;
+    files[i].mtime = B->files[i].mtime;
+    files[i].size = B->files[i].size;
+    offset += strlen(B->files[i].path) + 1;
+  }
+
+  for (int i = 0; i < B->refCount; i++)
+  {
+    if (i > 0 && strcmp(B->refs[i].symbol, B->refs[i - 1].symbol) == 0)
+    {
+      entries[i].symbol = entries[i - 1].symbol;
+    }
+    else
+    {
+      entries[i].symbol = (uint32_t)offset;
+      offset += strlen(B->refs[i].symbol) + 1;
+    }
+
+    entries[i].file = (uint32_t)B->refs[i].file;
+    entries[i].line = B->refs[i].line;
+    entries[i].col = B->refs[i].col;
+  }
+
+  header.stringsLength = offset;
+
+  bool ok = true;
+
+  if (offset > UINT32_MAX)
+  {
+    printf("**ERROR: index strings total %llu bytes, more than the 4GB an index can hold.\n", (unsigned long long)offset);
+    ok = false;
+  }
+
+  ok = ok && fwrite(&header, sizeof(header), 1, output) == 1;
+  ok = ok && fwrite(files, sizeof(struct IndexFile), (size_t)B->fileCount, output) == (size_t)B->fileCount;
+  ok = ok && fwrite(entries, sizeof(struct IndexEntry), (size_t)B->refCount, output) == (size_t)B->refCount;
+
+  for (int i = 0; ok && i < B->fileCount; i++)
+    ok = fwrite(B->files[i].path, strlen(B->files[i].path) + 1, 1, output) == 1;
+
+  for (int i = 0; ok && i < B->refCount; i++)
+  {
+    if (i > 0 && entries[i].symbol == entries[i - 1].symbol)
+      continue;
+    ok = fwrite(B->refs[i].symbol, strlen(B->refs[i].symbol) + 1, 1, output) == 1;
+  }
+
+  freeMemory(files);
+  freeMemory(entries);
+
+  return ok;
+}
+
+
+//
+// index_build
+//
+// Scans every .py file under the given directory and writes an index
+// of every identifier to indexPath, reusing unchanged files' entries
+// from the previous index.
+//
+int index_build(char* directory, char* indexPath)
+{
+  if (directory == NULL || indexPath == NULL)
+    panic("one or more parameters are NULL (index_build)");
+
+  struct Builder B;
+  memset(&B, 0, sizeof(B));
+
+  collect_files(&B, directory);
+
+  qsort(B.files, (size_t)B.fileCount, sizeof(struct SourceFile), compare_files);
+
+  //
+  // map the previous index (if any) and figure out which files are
+  // unchanged; oldToNew[i] is the new position of old file i, or -1:
+  //
+  struct MappedIndex old;
+  bool haveOld = index_map(indexPath, &old);
+
+  int* oldToNew = NULL;
+  int reused = 0;
+
+  if (haveOld)
+  {
+    oldToNew = (int*)allocMemory(sizeof(int) * ((size_t)old.header->fileCount + 1));
+    if (oldToNew == NULL) panic("out of memory (index_build)");
+
+    for (uint32_t i = 0; i < old.header->fileCount; i++)
+      oldToNew[i] = -1;
+  }
+
+  for (int i = 0; i < B.fileCount; i++)
+  {
+    int j = haveOld ? find_old_file(&old, B.files[i].path) : -1;
+
+    if (j >= 0 && old.files[j].mtime == B.files[i].mtime && old.files[j].size == B.files[i].size)
+    {
+      oldToNew[j] = i;
+      reused++;
+    }
+    else
+    {
+      scan_file(&B, i);
+    }
+  }
+
+  if (haveOld)
+  {
+    for (uint32_t i = 0; i < old.header->entryCount; i++)
+    {
+      struct IndexEntry* E = &old.entries[i];
+
+      if (oldToNew[E->file] >= 0)  // index_map checked E's offsets
+        builder_addRef(&B, old.strings + E->symbol, oldToNew[E->file], E->line, E->col);
+    }
+  }
+
+  qsort(B.refs, (size_t)B.refCount, sizeof(struct Ref), compare_refs);
+
+  //
+  // write to a temporary and rename, since the old index is still
+  // mapped and readers may have it open:
+  //
+  char* tempPath = dupStrings(indexPath, ".tmp");
+  FILE* output = fopen(tempPath, "wb");
+  int rc = 0;
+
+  if (output == NULL)
+  {
+    printf("**ERROR: unable to open index file '%s' for output.\n", tempPath);
+    rc = 1;
+  }
+  else
+  {
+    bool ok = write_index(&B, output);
+
+    if (fclose(output) != 0 || !ok || rename(tempPath, indexPath) != 0)
+    {
+      printf("**ERROR: unable to write index file '%s'.\n", indexPath);
+      remove(tempPath);
+      rc = 1;
+    }
+  }
+
+  if (rc == 0)
+    printf("**INDEX: %d files (%d rescanned, %d reused), %d identifiers\n",
+      B.fileCount, B.fileCount - reused, reused, B.refCount);
+
+  //
+  // done, free memory:
+  //
+  if (haveOld)
+  {
+    freeMemory(oldToNew);
+    index_unmap(&old);
+  }
+
+  for (int i = 0; i < B.fileCount; i++)
+    freeMemory(B.files[i].path);
+  for (int i = 0; i < B.ownedCount; i++)
+    freeMemory(B.owned[i]);
+
+  freeMemory(B.files);
+  freeMemory(B.refs);
+  freeMemory(B.owned);
+  freeMemory(tempPath);
+
+  return rc;
+}
+
+
+//
+// index_lookup
+//
+// Binary-searches the mapped index for the first entry with the given
+// symbol, then outputs every matching entry.
+//
+int index_lookup(char* indexPath, char* symbol)
+{
+  if (indexPath == NULL || symbol == NULL)
+    panic("one or more parameters are NULL (index_lookup)");
+
+  struct MappedIndex index;
+
+  if (!index_map(indexPath, &index))
+  {
+    printf("**ERROR: unable to open index file '%s'.\n", indexPath);
+    return -1;
+  }
+
+  uint32_t lo = 0;
+  uint32_t hi = index.header->entryCount;
+
+  while (lo < hi)  // lower bound:
+  {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (strcmp(index.strings + index.entries[mid].symbol, symbol) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  int found = 0;
+
+  for (uint32_t i = lo; i < index.header->entryCount; i++)
+  {
+    struct IndexEntry* E = &index.entries[i];
+
+    if (strcmp(index.strings + E->symbol, symbol) != 0)
+      break;
+
+    printf("%s:%d:%d\n", index.strings + index.files[E->file].path, E->line, E->col);
+    found++;
+  }
+
+  index_unmap(&index);
+
+  return found;
+}
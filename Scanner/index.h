@@ -0,0 +1,69 @@
+/*index.h*/
+
+#pragma once
+
+#include <stdint.h>  // uint32_t, int64_t
+
+
+//
+// On-disk identifier index
+//
+// The index file is laid out so it can be mmap'd and used in place:
+//
+//   IndexHeader
+//   IndexFile[fileCount]     sorted by path
+//   IndexEntry[entryCount]   sorted by (symbol, file, line, col)
+//   strings                  NUL-terminated paths and symbols
+//
+// All offsets are in bytes from the start of the file.
+//
+#define INDEX_MAGIC "NUPYIDX1"
+
+struct IndexHeader
+{
+  char     magic[8];
+  uint32_t fileCount;
+  uint32_t entryCount;
+  uint64_t filesOffset;
+  uint64_t entriesOffset;
+  uint64_t stringsOffset;
+  uint64_t stringsLength;
+};
+
+struct IndexFile
+{
+  uint32_t path;    // offset into strings
+  uint32_t unused;
+  int64_t  mtime;   // modification time (ns) when indexed
+  int64_t  size;    // file size when indexed
+};
+
+struct IndexEntry
+{
+  uint32_t symbol;  // offset into strings
+  uint32_t file;    // index into the IndexFile table
+  int32_t  line;
+  int32_t  col;
+};
+
+
+//
+// index_build
+//
+// Scans every .py file under the given directory and writes an index
+// of every nuPy_IDENTIFIER token to indexPath. If indexPath already
+// holds an index, files whose size and mtime are unchanged reuse their
+// entries from it instead of being scanned again.
+//
+// Returns 0 on success, non-zero on error (an error message is output).
+//
+int index_build(char* directory, char* indexPath);
+
+//
+// index_lookup
+//
+// Looks up the given symbol in the index via binary search and outputs
+// each reference as "file:line:col". Returns the number of references
+// found, or -1 if the index could not be opened.
+//
+int index_lookup(char* indexPath, char* symbol);
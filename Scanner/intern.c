@@ -0,0 +1,344 @@
+/*intern.c*/
+
+//
+// Concurrent intern table. Names live in hash chains that only ever
+// grow at the front: a lookup walks its chain without locking, and an
+// insert links a new node in with a compare-and-swap on the chain's
+// head, re-checking just the newly added nodes if the swap loses a
+// race. Symbol ids come from a shared counter, and each id's node is
+// published in a chunked directory for id-to-name lookups. An id is
+// taken before the insert is attempted, so two threads interning the
+// same new name at the same moment leave an unused id behind.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>    // true, false
+#include <string.h>     // strlen, memcpy, memcmp
+#include <time.h>       // clock_gettime
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "intern.h"
+
+
+#define CHUNK_SIZE 4096   // directory entries per chunk
+#define MAX_CHUNKS 16384  // => at most 64M symbols
+
+
+struct Node
+{
+  struct Node* next;
+  uint64_t     hash;
+  int          id;
+  int          length;
+  char         name[];
+};
+
+struct InternTable
+{
+  _Atomic(struct Node*)*  buckets;
+  uint64_t                mask;
+
+  atomic_int              nextId;
+  atomic_int              count;
+
+  _Atomic(_Atomic(struct Node*)*) chunks[MAX_CHUNKS];
+};
+
+
+//
+// intern_create
+//
+// Creates an empty table with 2^bucketsLog2 hash chains.
+//
+struct InternTable* intern_create(int bucketsLog2)
+{
+  if (bucketsLog2 < 1 || bucketsLog2 > 30)
+    panic("bucketsLog2 out of range (intern_create)");
+
+  struct InternTable* T = (struct InternTable*)allocMemory(sizeof(struct InternTable));
+  if (T == NULL) panic("out of memory (intern_create)");
+
+  size_t buckets = (size_t)1 << bucketsLog2;
+
+  T->buckets = (_Atomic(struct Node*)*)allocMemory(sizeof(_Atomic(struct Node*)) * buckets);
+  if (T->buckets == NULL) panic("out of memory (intern_create)");
+
+  for (size_t b = 0; b < buckets; b++)
+    atomic_init(&T->buckets[b], NULL);
+
+  for (int c = 0; c < MAX_CHUNKS; c++)
+    atomic_init(&T->chunks[c], NULL);
+
+  T->mask = buckets - 1;
+  atomic_init(&T->nextId, 0);
+  atomic_init(&T->count, 0);
+
+  return T;
+}
+
+
+//
+// intern_destroy
+//
+// Frees the table and all interned names.
+//
+void intern_destroy(struct InternTable* T)
+{
+  if (T == NULL)
+    return;
+
+  for (uint64_t b = 0; b <= T->mask; b++)
+  {
+    struct Node* n = atomic_load(&T->buckets[b]);
+
+    while (n != NULL)
+    {
+      struct Node* next = n->next;
+      freeMemory(n);
+      n = next;
+    }
+  }
+
+  for (int c = 0; c < MAX_CHUNKS; c++)
+    freeMemory((void*)atomic_load(&T->chunks[c]));
+
+  freeMemory(T->buckets);
+  freeMemory(T);
+}
+
+
+//
+// publish
+//
+// Records the node under its id in the directory, allocating the
+// id's chunk if this is the first id in it.
+//
+static void publish(struct InternTable* T, struct Node* node)
+{
+  int c = node->id / CHUNK_SIZE;
+
+  if (c >= MAX_CHUNKS)
+    panic("too many symbols (intern_symbol)");
+
+  _Atomic(struct Node*)* chunk = atomic_load_explicit(&T->chunks[c], memory_order_acquire);
+
+  if (chunk == NULL)
+  {
+    _Atomic(struct Node*)* fresh = (_Atomic(struct Node*)*)callocMemory(CHUNK_SIZE, sizeof(_Atomic(struct Node*)));
+    if (fresh == NULL) panic("out of memory (intern_symbol)");
+
+    if (atomic_compare_exchange_strong_explicit(&T->chunks[c], &chunk, fresh, memory_order_acq_rel, memory_order_acquire))
+      chunk = fresh;
+    else
+      freeMemory((void*)fresh);  // another thread allocated it, chunk is now theirs
+  }
+
+  atomic_store_explicit(&chunk[node->id % CHUNK_SIZE], node, memory_order_release);
+}
+
+
+//
+// intern_symbol
+//
+// Returns the symbol id of the given name, interning it if needed.
+//
+int intern_symbol(struct InternTable* T, const char* name)
+{
+  if (T == NULL || name == NULL)
+    panic("one or more parameters are NULL (intern_symbol)");
+
+  int length = (int)strlen(name);
+  uint64_t hash = hashBytes(name, (size_t)length);
+  _Atomic(struct Node*)* bucket = &T->buckets[hash & T->mask];
+
+  struct Node* head = atomic_load_explicit(bucket, memory_order_acquire);
+  struct Node* checked = NULL;  // nodes from here on were already compared
+  struct Node* node = NULL;
+
+  while (true)
+  {
+    for (struct Node* n = head; n != checked; n = n->next)
+    {
+      if (n->hash == hash && n->length == length && memcmp(n->name, name, (size_t)length) == 0)
+      {
+        if (node != NULL)  // lost a race to insert the same name, its
+          freeMemory(node);      // id is simply never used
+        return n->id;
+      }
+    }
+
+    if (node == NULL)
+    {
+      node = (struct Node*)allocMemory(sizeof(struct Node) + (size_t)length + 1);
+      if (node == NULL) panic("out of memory (intern_symbol)");
+
+      node->hash = hash;
+      node->length = length;
+      node->id = atomic_fetch_add(&T->nextId, 1);
+      memcpy(node->name, name, (size_t)length + 1);
+    }
+
+    node->next = head;
+    checked = head;
+
+    // on failure, head is reloaded with the current head of the chain:
+    if (atomic_compare_exchange_weak_explicit(bucket, &head, node, memory_order_release, memory_order_acquire))
+      break;
+  }
+
+  publish(T, node);
+  atomic_fetch_add(&T->count, 1);
+
+  return node->id;
+}
+
+
+//
+// intern_name
+//
+// Returns the interned name with the given symbol id, or NULL.
+//
+const char* intern_name(struct InternTable* T, int id)
+{
+  if (T == NULL || id < 0 || id >= atomic_load(&T->nextId))
+    return NULL;
+
+  _Atomic(struct Node*)* chunk = atomic_load_explicit(&T->chunks[id / CHUNK_SIZE], memory_order_acquire);
+  if (chunk == NULL)
+    return NULL;
+
+  struct Node* node = atomic_load_explicit(&chunk[id % CHUNK_SIZE], memory_order_acquire);
+
+  return (node == NULL) ? NULL : node->name;
+}
+
+
+//
+// intern_count
+//
+// Returns the number of distinct names interned so far.
+//
+int intern_count(struct InternTable* T)
+{
+  return atomic_load(&T->count);
+}
+
+
+//
+// BenchThread
+//
+// Arguments of one benchmark thread: intern every name into table.
+//
+struct BenchThread
+{
+  struct InternTable* table;
+  char**              names;
+  int                 count;
+  pthread_t           thread;
+};
+
+static void* bench_thread(void* arg)
+{
+  struct BenchThread* B = (struct BenchThread*)arg;
+
+  for (int i = 0; i < B->count; i++)
+    intern_symbol(B->table, B->names[i]);
+
+  return NULL;
+}
+
+
+//
+// intern_benchmark
+//
+// Outputs the throughput of a shared table as the number of threads
+// interning into it doubles from 1 to maxThreads.
+//
+void intern_benchmark(char** files, int fileCount, int maxThreads)
+{
+  //
+  // collect every identifier in the files:
+  //
+  struct TokenArray* A = tokenarray_create();
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    FILE* input = fopen(files[f], "r");
+
+    if (input == NULL)
+    {
+      printf("**ERROR: unable to open input file '%s' for input.\n", files[f]);
+      continue;
+    }
+
+    tokenarray_scan(A, input);
+    fclose(input);
+  }
+
+  char** names = (char**)allocMemory(sizeof(char*) * ((size_t)A->count + 1));
+  if (names == NULL) panic("out of memory (intern_benchmark)");
+
+  int count = 0;
+
+  for (int i = 0; i < A->count; i++)
+  {
+    if (A->ids[i] == nuPy_IDENTIFIER)
+      names[count++] = tokenarray_value(A, i);
+  }
+
+  if (count == 0)
+  {
+    printf("**INTERN: no identifiers to intern\n");
+    freeMemory(names);
+    tokenarray_destroy(A);
+    return;
+  }
+
+  //
+  // run with 1, 2, 4, ... threads, each interning every name:
+  //
+  struct BenchThread* threads = (struct BenchThread*)allocMemory(sizeof(struct BenchThread) * maxThreads);
+  if (threads == NULL) panic("out of memory (intern_benchmark)");
+
+  for (int n = 1; n <= maxThreads; n *= 2)
+  {
+    struct InternTable* table = intern_create(16);
+    struct timespec start, stop;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (int t = 0; t < n; t++)
+    {
+      threads[t].table = table;
+      threads[t].names = names;
+      threads[t].count = count;
+
+      if (pthread_create(&threads[t].thread, NULL, bench_thread, &threads[t]) != 0)
+        panic("unable to create thread (intern_benchmark)");
+    }
+
+    for (int t = 0; t < n; t++)
+      pthread_join(threads[t].thread, NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    double secs = (stop.tv_sec - start.tv_sec) + (stop.tv_nsec - start.tv_nsec) / 1e9;
+    double ops = (double)count * n;
+
+    printf("**INTERN: %2d threads, %d distinct of %.0f lookups, %.3f ms, %.2f M lookups/sec\n",
+      n, intern_count(table), ops, secs * 1000.0, ops / secs / 1e6);
+
+    intern_destroy(table);
+  }
+
+  freeMemory(threads);
+  freeMemory(names);
+  tokenarray_destroy(A);
+}
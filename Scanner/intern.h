@@ -0,0 +1,66 @@
+/*intern.h*/
+
+#pragma once
+
+
+//
+// InternTable
+//
+// A concurrent table of interned identifier names, shared by threads.
+// Each distinct name is stored once and assigned a global symbol id,
+// so ids from different threads (and files) can be compared directly.
+// Lookups take no locks; inserts publish new names with a
+// compare-and-swap, and nothing is ever removed until the table is
+// destroyed.
+//
+struct InternTable;
+
+
+//
+// intern_create
+//
+// Creates an empty table with 2^bucketsLog2 hash chains; size this
+// for the expected number of distinct names (the table never resizes,
+// so chains simply grow longer if it is undersized).
+//
+struct InternTable* intern_create(int bucketsLog2);
+
+//
+// intern_destroy
+//
+// Frees the table and all interned names. No thread may be using
+// the table.
+//
+void intern_destroy(struct InternTable* table);
+
+//
+// intern_symbol
+//
+// Returns the symbol id (>= 0) of the given name, interning it if
+// it is not already present. Safe to call from multiple threads.
+//
+int intern_symbol(struct InternTable* table, const char* name);
+
+//
+// intern_name
+//
+// Returns the interned name with the given symbol id (owned by the
+// table), or NULL if there is no such id.
+//
+const char* intern_name(struct InternTable* table, int id);
+
+//
+// intern_count
+//
+// Returns the number of distinct names interned so far.
+//
+int intern_count(struct InternTable* table);
+
+//
+// intern_benchmark
+//
+// Collects every identifier in the given files, then for 1, 2, 4, ...
+// up to maxThreads threads, has every thread intern all of them into
+// a fresh shared table and outputs the throughput at each count.
+//
+void intern_benchmark(char** files, int fileCount, int maxThreads);
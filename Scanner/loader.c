@@ -0,0 +1,690 @@
+/*loader.c*/
+
+//
+// Batched file loading for the batch checker. A background thread
+// submits opens and reads for many files at once through io_uring
+// (using the raw system calls, so no library is needed); if io_uring
+// is unavailable a small pool of threads reads the files instead.
+// Either way, loaded files go into a bounded queue from which the
+// scanner workers take them, so I/O overlaps with lexing.
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>   // true, false
+#include <string.h>    // memset
+#include <fcntl.h>     // open, AT_FDCWD
+#include <unistd.h>    // read, close, syscall
+#include <errno.h>     // EINVAL
+#include <sys/stat.h>  // fstat
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+#include "util.h"
+#include "loader.h"
+
+
+#define LOADER_THREADS 4    // readers when falling back to threads
+#define RING_ENTRIES   64   // io_uring submission queue size
+#define MAX_INFLIGHT   32   // files with an open or read outstanding
+#define MAX_READ       (1u << 30)  // bytes per read; larger files take several
+
+
+struct Loader
+{
+  char**              paths;
+  int                 count;
+
+  pthread_mutex_t     lock;
+  pthread_cond_t      notEmpty;
+  pthread_cond_t      notFull;
+  struct LoadedFile** queue;    // circular, holds up to capacity files
+  int                 capacity;
+  int                 head;
+  int                 size;
+  int                 taken;    // files handed out by loader_next
+
+  bool                uring;
+  atomic_int          nextPath; // next file for the reader threads
+  pthread_t           threads[LOADER_THREADS];
+  int                 threadCount;
+
+#if HAVE_IO_URING
+  struct Ring*        ring;
+#endif
+};
+
+
+//
+// queue_push
+//
+// Adds a loaded file to the queue, waiting while the queue is full.
+//
+static void queue_push(struct Loader* L, struct LoadedFile* file)
+{
+  pthread_mutex_lock(&L->lock);
+
+  while (L->size == L->capacity)
+    pthread_cond_wait(&L->notFull, &L->lock);
+
+  L->queue[(L->head + L->size) % L->capacity] = file;
+  L->size++;
+
+  pthread_cond_signal(&L->notEmpty);
+  pthread_mutex_unlock(&L->lock);
+}
+
+
+//
+// new_file
+//
+// Allocates a LoadedFile for the given path index; data is attached
+// by the caller.
+//
+static struct LoadedFile* new_file(int index)
+{
+  struct LoadedFile* file = (struct LoadedFile*)allocMemory(sizeof(struct LoadedFile));
+  if (file == NULL) panic("out of memory (loader new_file)");
+
+  file->index = index;
+  file->data = NULL;
+  file->length = 0;
+  file->ok = false;
+
+  return file;
+}
+
+
+//
+// read_file
+//
+// Reads the file at the given path synchronously: open, fstat,
+// read, close.
+//
+static struct LoadedFile* read_file(char* path, int index)
+{
+  struct LoadedFile* file = new_file(index);
+
+  int fd = open(path, O_RDONLY);
+  if (fd < 0)
+    return file;
+
+  struct stat st;
+  if (fstat(fd, &st) < 0)
+  {
+    close(fd);
+    return file;
+  }
+
+  size_t capacity = (size_t)st.st_size + 1;
+  char* data = (char*)allocMemory(capacity);
+  if (data == NULL) panic("out of memory (loader read_file)");
+
+  size_t length = 0;
+  ssize_t n;
+
+  while (length < capacity - 1 && (n = read(fd, data + length, capacity - 1 - length)) > 0)
+    length += (size_t)n;
+
+  close(fd);
+
+  data[length] = '\0';
+
+  file->data = data;
+  file->length = length;
+  file->ok = true;
+
+  return file;
+}
+
+
+//
+// thread_reader
+//
+// Fallback reader thread: claims files one at a time until none remain.
+//
+static void* thread_reader(void* arg)
+{
+  struct Loader* L = (struct Loader*)arg;
+
+  while (true)
+  {
+    int index = atomic_fetch_add(&L->nextPath, 1);
+    if (index >= L->count)
+      break;
+
+    queue_push(L, read_file(L->paths[index], index));
+  }
+
+  return NULL;
+}
+
+
+#if HAVE_IO_URING
+
+//
+// Ring
+//
+// A minimal io_uring: the mapped submission and completion queues.
+//
+struct Ring
+{
+  int                  fd;
+  unsigned*            sqHead;
+  unsigned*            sqTail;
+  unsigned*            sqMask;
+  unsigned*            sqArray;
+  unsigned             sqEntries;
+  struct io_uring_sqe* sqes;
+  unsigned*            cqHead;
+  unsigned*            cqTail;
+  unsigned*            cqMask;
+  struct io_uring_cqe* cqes;
+
+  void*                sqMap;
+  size_t               sqMapLength;
+  void*                cqMap;
+  size_t               cqMapLength;
+  size_t               sqesLength;
+
+  unsigned             unsubmitted;
+};
+
+//
+// Pending
+//
+// A file whose read is in progress via the ring.
+//
+struct Pending
+{
+  int    fd;
+  char*  data;
+  size_t length;   // expected size (from fstat)
+  size_t done;     // bytes read so far
+};
+
+#define OP_OPEN 0
+#define OP_READ 1
+
+
+//
+// ring_create
+//
+// Sets up an io_uring; returns NULL if the kernel doesn't allow it.
+//
+static struct Ring* ring_create(unsigned entries)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+
+  int fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (fd < 0)
+    return NULL;
+
+  struct Ring* R = (struct Ring*)allocMemory(sizeof(struct Ring));
+  if (R == NULL) panic("out of memory (ring_create)");
+
+  memset(R, 0, sizeof(struct Ring));
+  R->fd = fd;
+
+  R->sqMapLength = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  R->cqMapLength = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+
+  bool single = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single && R->cqMapLength > R->sqMapLength)
+    R->sqMapLength = R->cqMapLength;
+
+  R->sqMap = mmap(NULL, R->sqMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+  R->cqMap = single ? R->sqMap :
+    mmap(NULL, R->cqMapLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+
+  R->sqesLength = params.sq_entries * sizeof(struct io_uring_sqe);
+  R->sqes = (struct io_uring_sqe*)mmap(NULL, R->sqesLength, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+
+  if (R->sqMap == MAP_FAILED || R->cqMap == MAP_FAILED || R->sqes == MAP_FAILED)
+  {
+    // unusual, but treat as io_uring unavailable:
+    if (R->sqMap != MAP_FAILED) munmap(R->sqMap, R->sqMapLength);
+    if (!single && R->cqMap != MAP_FAILED) munmap(R->cqMap, R->cqMapLength);
+    if (R->sqes != MAP_FAILED) munmap(R->sqes, R->sqesLength);
+    close(fd);
+    freeMemory(R);
+    return NULL;
+  }
+
+  char* sq = (char*)R->sqMap;
+  char* cq = (char*)R->cqMap;
+
+  R->sqHead = (unsigned*)(sq + params.sq_off.head);
+  R->sqTail = (unsigned*)(sq + params.sq_off.tail);
+  R->sqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+  R->sqArray = (unsigned*)(sq + params.sq_off.array);
+  R->sqEntries = params.sq_entries;
+
+  R->cqHead = (unsigned*)(cq + params.cq_off.head);
+  R->cqTail = (unsigned*)(cq + params.cq_off.tail);
+  R->cqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+  R->cqes = (struct io_uring_cqe*)(cq + params.cq_off.cqes);
+
+  return R;
+}
+
+
+static void ring_destroy(struct Ring* R)
+{
+  munmap(R->sqes, R->sqesLength);
+  if (R->cqMap != R->sqMap)
+    munmap(R->cqMap, R->cqMapLength);
+  munmap(R->sqMap, R->sqMapLength);
+  close(R->fd);
+  freeMemory(R);
+}
+
+
+//
+// ring_getSqe
+//
+// Returns the next free submission queue entry (cleared), or NULL
+// if the submission queue is full.
+//
+static struct io_uring_sqe* ring_getSqe(struct Ring* R)
+{
+  unsigned tail = *R->sqTail;
+  unsigned head = __atomic_load_n(R->sqHead, __ATOMIC_ACQUIRE);
+
+  if (tail - head == R->sqEntries)
+    return NULL;
+
+  unsigned index = tail & *R->sqMask;
+  struct io_uring_sqe* sqe = &R->sqes[index];
+
+  memset(sqe, 0, sizeof(struct io_uring_sqe));
+  R->sqArray[index] = index;
+
+  __atomic_store_n(R->sqTail, tail + 1, __ATOMIC_RELEASE);
+  R->unsubmitted++;
+
+  return sqe;
+}
+
+
+//
+// ring_submitAndWait
+//
+// Submits the new entries and waits for at least one completion.
+//
+static int ring_submitAndWait(struct Ring* R)
+{
+  int rc;
+
+  do
+  {
+    rc = (int)syscall(__NR_io_uring_enter, R->fd, R->unsubmitted, 1, IORING_ENTER_GETEVENTS, NULL, 0);
+  } while (rc < 0 && errno == EINTR);
+
+  if (rc >= 0)
+    R->unsubmitted -= (unsigned)rc;
+
+  return rc;
+}
+
+
+static void prep_read(struct Ring* R, struct Pending* P, int index)
+{
+  struct io_uring_sqe* sqe = ring_getSqe(R);
+  if (sqe == NULL) panic("submission queue full (loader prep_read)");
+
+  //
+  // sqe->len is 32 bits, so a file of 4GB or more is read in pieces;
+  // each completion continues where the last one stopped:
+  //
+  size_t remaining = P->length - P->done;
+
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = P->fd;
+  sqe->addr = (unsigned long)(P->data + P->done);
+  sqe->len = (unsigned)(remaining < MAX_READ ? remaining : MAX_READ);
+  sqe->off = P->done;
+  sqe->user_data = ((unsigned long long)index << 1) | OP_READ;
+}
+
+
+//
+// finish_pending
+//
+// Closes the file and hands it to the queue: as loaded if data is
+// attached, otherwise via a synchronous read if retry is true (the
+// kernel didn't support the operation), otherwise as failed.
+//
+static void finish_pending(struct Loader* L, struct Pending* P, int index, bool retry)
+{
+  if (P->fd >= 0)
+    close(P->fd);
+
+  if (P->data == NULL)
+  {
+    queue_push(L, retry ? read_file(L->paths[index], index) : new_file(index));
+    return;
+  }
+
+  struct LoadedFile* file = new_file(index);
+
+  P->data[P->done] = '\0';
+  file->data = P->data;
+  file->length = P->done;
+  file->ok = true;
+
+  queue_push(L, file);
+}
+
+
+//
+// uring_reader
+//
+// Loader thread when io_uring is available: keeps up to MAX_INFLIGHT
+// files in progress, submitting an open for each, then a read sized
+// from fstat, until every file has been loaded.
+//
+static void* uring_reader(void* arg)
+{
+  struct Loader* L = (struct Loader*)arg;
+  struct Ring* R = L->ring;
+
+  struct Pending* pending = (struct Pending*)callocMemory((size_t)L->count + 1, sizeof(struct Pending));
+  if (pending == NULL) panic("out of memory (uring_reader)");
+
+  int next = 0;
+  int inflight = 0;
+
+  while (next < L->count || inflight > 0)
+  {
+    while (next < L->count && inflight < MAX_INFLIGHT)
+    {
+      struct io_uring_sqe* sqe = ring_getSqe(R);
+      if (sqe == NULL)
+        break;
+
+      pending[next].fd = -1;
+
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = AT_FDCWD;
+      sqe->addr = (unsigned long)L->paths[next];
+      sqe->open_flags = O_RDONLY;
+      sqe->user_data = ((unsigned long long)next << 1) | OP_OPEN;
+
+      next++;
+      inflight++;
+    }
+
+    if (ring_submitAndWait(R) < 0)
+      panic("io_uring_enter failed (uring_reader)");
+
+    unsigned head = *R->cqHead;
+    unsigned tail = __atomic_load_n(R->cqTail, __ATOMIC_ACQUIRE);
+
+    for (; head != tail; head++)
+    {
+      struct io_uring_cqe* cqe = &R->cqes[head & *R->cqMask];
+      int index = (int)(cqe->user_data >> 1);
+      int res = cqe->res;
+      struct Pending* P = &pending[index];
+
+      if ((cqe->user_data & 1) == OP_OPEN)
+      {
+        struct stat st;
+
+        if (res < 0 || fstat(res, &st) < 0)
+        {
+          if (res >= 0)
+            P->fd = res;
+          finish_pending(L, P, index, res == -EINVAL);
+          inflight--;
+          continue;
+        }
+
+        P->fd = res;
+        P->length = (size_t)st.st_size;
+        P->data = (char*)allocMemory(P->length + 1);
+        if (P->data == NULL) panic("out of memory (uring_reader)");
+
+        if (P->length == 0)
+        {
+          finish_pending(L, P, index, false);
+          inflight--;
+        }
+        else
+        {
+          prep_read(R, P, index);
+        }
+      }
+      else  // OP_READ
+      {
+        if (res < 0)
+        {
+          freeMemory(P->data);
+          P->data = NULL;
+          finish_pending(L, P, index, res == -EINVAL);
+          inflight--;
+          continue;
+        }
+
+        P->done += (size_t)res;
+
+        if (res == 0 || P->done == P->length)
+        {
+          finish_pending(L, P, index, false);
+          inflight--;
+        }
+        else
+        {
+          prep_read(R, P, index);  // short read, continue where it stopped
+        }
+      }
+    }
+
+    __atomic_store_n(R->cqHead, head, __ATOMIC_RELEASE);
+  }
+
+  freeMemory(pending);
+
+  return NULL;
+}
+
+#endif
+
+
+//
+// loader_start
+//
+// Starts loading the given files in the background; see loader.h.
+//
+struct Loader* loader_start(char** paths, int count, int queueCapacity)
+{
+  if (paths == NULL && count > 0)
+    panic("paths is NULL (loader_start)");
+
+  struct Loader* L = (struct Loader*)allocMemory(sizeof(struct Loader));
+  if (L == NULL) panic("out of memory (loader_start)");
+
+  L->paths = paths;
+  L->count = count;
+
+  pthread_mutex_init(&L->lock, NULL);
+  pthread_cond_init(&L->notEmpty, NULL);
+  pthread_cond_init(&L->notFull, NULL);
+
+  L->capacity = (queueCapacity > 0) ? queueCapacity : 1;
+  L->queue = (struct LoadedFile**)allocMemory(sizeof(struct LoadedFile*) * L->capacity);
+  if (L->queue == NULL) panic("out of memory (loader_start)");
+
+  L->head = 0;
+  L->size = 0;
+  L->taken = 0;
+  L->uring = false;
+  L->threadCount = 0;
+  atomic_init(&L->nextPath, 0);
+
+  if (count == 0)
+    return L;
+
+#if HAVE_IO_URING
+  L->ring = ring_create(RING_ENTRIES);
+
+  if (L->ring != NULL)
+  {
+    L->uring = true;
+
+    if (pthread_create(&L->threads[0], NULL, uring_reader, L) != 0)
+      panic("unable to create thread (loader_start)");
+
+    L->threadCount = 1;
+    return L;
+  }
+#endif
+
+  for (int t = 0; t < LOADER_THREADS && t < count; t++)
+  {
+    if (pthread_create(&L->threads[t], NULL, thread_reader, L) != 0)
+      panic("unable to create thread (loader_start)");
+
+    L->threadCount++;
+  }
+
+  return L;
+}
+
+
+//
+// loader_next
+//
+// Returns the next loaded file, waiting if necessary, or NULL once
+// every file has been handed out.
+//
+struct LoadedFile* loader_next(struct Loader* L)
+{
+  bool done;
+
+  return loader_nextOr(L, NULL, NULL, &done);
+}
+
+
+//
+// loader_nextOr
+//
+// loader_next, but also stops waiting once ready(arg); see loader.h.
+//
+struct LoadedFile* loader_nextOr(struct Loader* L, bool (*ready)(void* arg), void* arg, bool* done)
+{
+  pthread_mutex_lock(&L->lock);
+
+  // ready is checked under the lock, so a loader_wake can't be missed:
+  while (L->size == 0 && L->taken < L->count && (ready == NULL || !ready(arg)))
+    pthread_cond_wait(&L->notEmpty, &L->lock);
+
+  struct LoadedFile* file = NULL;
+
+  if (L->size > 0)
+  {
+    file = L->queue[L->head];
+    L->head = (L->head + 1) % L->capacity;
+    L->size--;
+    L->taken++;
+
+    pthread_cond_signal(&L->notFull);
+
+    if (L->taken == L->count)  // wake everyone else up to see we're done
+      pthread_cond_broadcast(&L->notEmpty);
+  }
+
+  *done = (file == NULL && L->taken == L->count);
+
+  pthread_mutex_unlock(&L->lock);
+
+  return file;
+}
+
+
+//
+// loader_wake
+//
+// Wakes every thread waiting in loader_nextOr to recheck its ready
+// function.
+//
+void loader_wake(struct Loader* L)
+{
+  pthread_mutex_lock(&L->lock);
+  pthread_cond_broadcast(&L->notEmpty);
+  pthread_mutex_unlock(&L->lock);
+}
+
+
+//
+// loader_free
+//
+// Frees a file returned by loader_next.
+//
+void loader_free(struct LoadedFile* file)
+{
+  if (file == NULL)
+    return;
+
+  freeMemory(file->data);
+  freeMemory(file);
+}
+
+
+//
+// loader_method
+//
+// Returns "io_uring" or "threads", whichever the loader is using.
+//
+char* loader_method(struct Loader* L)
+{
+  return L->uring ? "io_uring" : "threads";
+}
+
+
+//
+// loader_finish
+//
+// Waits for the background loading to stop and frees the loader.
+//
+void loader_finish(struct Loader* L)
+{
+  if (L == NULL)
+    return;
+
+  for (int t = 0; t < L->threadCount; t++)
+    pthread_join(L->threads[t], NULL);
+
+#if HAVE_IO_URING
+  if (L->uring)
+    ring_destroy(L->ring);
+#endif
+
+  // anything not taken (shouldn't happen) is freed here:
+  while (L->size > 0)
+  {
+    loader_free(L->queue[L->head]);
+    L->head = (L->head + 1) % L->capacity;
+    L->size--;
+  }
+
+  pthread_mutex_destroy(&L->lock);
+  pthread_cond_destroy(&L->notEmpty);
+  pthread_cond_destroy(&L->notFull);
+
+  freeMemory(L->queue);
+  freeMemory(L);
+}
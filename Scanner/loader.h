@@ -0,0 +1,87 @@
+/*loader.h*/
+
+#pragma once
+
+#include <stdbool.h>  // true, false
+#include <stddef.h>   // size_t
+
+
+//
+// LoadedFile
+//
+// The complete contents of one input file, NUL-terminated. If the
+// file could not be read, ok is false and data is NULL.
+//
+struct LoadedFile
+{
+  int    index;   // position of the file in the loader's path list
+  char*  data;
+  size_t length;
+  bool   ok;
+};
+
+struct Loader;
+
+
+//
+// loader_start
+//
+// Starts loading the given files in the background and returns
+// immediately. Opens and reads are submitted in batches through
+// io_uring when the kernel supports it, otherwise the files are read
+// by a small pool of threads. Loaded files are handed out in
+// completion order through loader_next; at most queueCapacity loaded
+// files are held before the loader waits for them to be taken.
+//
+struct Loader* loader_start(char** paths, int count, int queueCapacity);
+
+//
+// loader_next
+//
+// Returns the next loaded file, waiting if necessary, or NULL once
+// every file has been handed out. Safe to call from multiple threads.
+// The caller owns the result and frees it with loader_free.
+//
+struct LoadedFile* loader_next(struct Loader* L);
+
+//
+// loader_nextOr
+//
+// Like loader_next, but also stops waiting, returning NULL, as soon as
+// ready(arg) returns true, so a caller with other work (e.g. a queue
+// filled by other threads) isn't stuck waiting for I/O while that work
+// is pending. ready is called with the loader's lock held, so it must
+// be quick and must not call into the loader; whoever makes it true
+// must then call loader_wake. *done is set to true when NULL is
+// returned because every file has been handed out.
+//
+struct LoadedFile* loader_nextOr(struct Loader* L, bool (*ready)(void* arg), void* arg, bool* done);
+
+//
+// loader_wake
+//
+// Wakes the threads waiting in loader_nextOr so they recheck ready.
+//
+void loader_wake(struct Loader* L);
+
+//
+// loader_free
+//
+// Frees a file returned by loader_next.
+//
+void loader_free(struct LoadedFile* file);
+
+//
+// loader_method
+//
+// Returns "io_uring" or "threads", whichever the loader is using.
+//
+char* loader_method(struct Loader* L);
+
+//
+// loader_finish
+//
+// Waits for the background loading to stop and frees the loader.
+// Every file should have been taken via loader_next first.
+//
+void loader_finish(struct Loader* L);
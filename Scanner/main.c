@@ -13,15 +13,309 @@
 #include "token.h"    // token defs
 #include "scanner.h"  // scanner
 #include "util.h"     // panic
+#include "forkserver.h"  // forkserver_run
+#include "index.h"       // index_build, index_lookup
+#include "search.h"      // search_run
+#include "batch.h"       // batch_check
+#include "intern.h"      // intern_benchmark
+#include "bench.h"       // bench_run, bench_compare
+#include "stress.h"      // stress_run
+#include "shmtokens.h"   // shmtokens_produce, shmtokens_consume
+#include "metrics.h"     // metrics_countAllocations, metrics_start, metrics_count
+#include "repl.h"        // repl_run
+#include "structscan.h"  // structscan_verify
+#include "flightrec.h"   // flightrec_start
 
 
 
 
+//
+// printTokens
+//
+// Scans the given input stream token by token until EOS, and
+// outputs each token (including the final EOS token).
+//
+static void printTokens(FILE* input)
+{
+  int lineNumber = -1;
+  int colNumber = -1;
+  char value[SCANNER_MAX_VALUE] = "";
+  struct Token T;
+  struct StringBuilder line;
+  long tokens = 0, errors = 0;
+
+  sbInit(&line);
+  scanner_init(&lineNumber, &colNumber, value);
+
+  T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+
+  while (true)
+  {
+    //
+    // render "Token id ('value') @ (line, col)" without printf; each
+    // line is written before scanning on, since the scanner outputs
+    // its warnings as it goes:
+    //
+    sbReset(&line);
+    sbAppend(&line, "Token ");
+    sbAppendInt(&line, T.id);
+    sbAppend(&line, " ('");
+    sbAppend(&line, value);
+    sbAppend(&line, "') @ (");
+    sbAppendInt(&line, T.line);
+    sbAppend(&line, ", ");
+    sbAppendInt(&line, T.col);
+    sbAppend(&line, ")\n");
+
+    fwrite(line.data, 1, line.length, stdout);
+
+    if (T.id == nuPy_EOS)
+      break;
+
+    tokens++;
+    if (T.id == nuPy_UNKNOWN)
+      errors++;
+
+    T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+  }
+
+  sbFree(&line);
+
+  metrics_count(METRIC_TOKENS, tokens);
+  metrics_count(METRIC_ERRORS, errors);
+}
+
+
+//
+// scanFile
+//
+// Opens the given nuPython file and outputs its tokens. Returns 0
+// on success, non-zero if the file could not be opened.
+//
+static int scanFile(char* filename)
+{
+  FILE* input = fopen(filename, "r");
+
+  if (input == NULL)
+  {
+    printf("**ERROR: unable to open input file '%s' for input.\n", filename);
+    return 1;
+  }
+
+  printTokens(input);
+
+  long bytes = ftell(input);
+  if (bytes > 0)
+    metrics_count(METRIC_BYTES, bytes);
+
+  fclose(input);
+
+  return 0;
+}
+
+
 //
 // main
 //
+// Usage:
+//   main                        interactive: prompt for a file or keyboard input
+//   main file.py                output the tokens of the given file
+//   main --fork-server [--baseline] [--cache MB] [--metrics socket]
+//                               read filenames from stdin, one per line, and
+//                               serve each from a pre-warmed forked child;
+//                               --baseline also times a cold exec per request,
+//                               --cache keeps up to MB of results in memory,
+//                               --metrics serves Prometheus metrics on socket
+//   main --index dir file.idx   index every identifier in the .py files under dir
+//                               (incremental if file.idx already exists)
+//   main --lookup file.idx name output every reference to the identifier name
+//   main --search [--cache dir] pattern file...
+//                               token-aware search, e.g. "IDENTIFIER '=' IDENTIFIER '('";
+//                               --cache keeps each file's tokens in dir
+//   main --check [--timeout ms] file...
+//                               check many files in parallel, optionally
+//                               cancelling any file that takes longer than ms
+//   main --bench-intern file... time the shared intern table at 1..64 threads
+//   main --bench [--perf] [--repeat n] file...
+//                               time the scanner over the files in memory;
+//                               --perf adds hardware performance counters
+//   main --bench-python [--size KB] [--repeat n]
+//                               compare the scanner with CPython's tokenize
+//                               and ast.parse on equivalent synthetic programs
+//   main --stress [--max KB]    run the pathological-input suite at doubling
+//                               sizes up to KB, failing on super-linear time
+//                               or memory, crashes and hangs
+//   main --shm-consume socket   accept a producer on the Unix socket and read
+//                               its token arrays from shared memory
+//   main --shm-produce socket file...
+//                               scan the files and hand each token array to
+//                               the consumer as a sealed memfd, zero-copy
+//   main --structscan file...   check the two-stage structural scanner against
+//                               scanner_nextToken on each file
+//   main --repl                 read statements from stdin and process each
+//                               one as soon as it is complete
+//
+// Any of the above can be preceded by --flight-recorder, which records
+// the last tokens scanned by each thread and dumps them to stderr on a
+// panic, a crash or SIGUSR1.
+//
 int main(int argc, char* argv[])
 {
+  //
+  // the counting allocator must see every block, so it goes in before
+  // anything else runs:
+  //
+  for (int i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "--metrics") == 0)
+    {
+      metrics_countAllocations();
+      break;
+    }
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--flight-recorder") == 0)
+  {
+    flightrec_start();
+
+    argv[1] = argv[0];
+    argc--;
+    argv++;
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--fork-server") == 0)
+  {
+    bool baseline = false;
+    size_t cacheBytes = 0;
+
+    for (int i = 2; i < argc; i++)
+    {
+      if (strcmp(argv[i], "--baseline") == 0)
+        baseline = true;
+      else if (strcmp(argv[i], "--cache") == 0 && i + 1 < argc)
+        cacheBytes = (size_t)(atof(argv[++i]) * 1024 * 1024);
+      else if (strcmp(argv[i], "--metrics") == 0 && i + 1 < argc)
+      {
+        if (!metrics_start(argv[++i]))
+          return 1;
+      }
+    }
+
+    return forkserver_run(stdin, scanFile, baseline ? argv[0] : NULL, cacheBytes);
+  }
+
+  if (argc == 4 && strcmp(argv[1], "--index") == 0)
+  {
+    return index_build(argv[2], argv[3]);
+  }
+
+  if (argc == 4 && strcmp(argv[1], "--lookup") == 0)
+  {
+    return (index_lookup(argv[2], argv[3]) < 0) ? 1 : 0;
+  }
+
+  if (argc >= 5 && strcmp(argv[1], "--search") == 0 && strcmp(argv[2], "--cache") == 0)
+  {
+    return (search_run(argv[4], argv + 5, argc - 5, 0, argv[3]) < 0) ? 1 : 0;
+  }
+
+  if (argc >= 3 && strcmp(argv[1], "--search") == 0)
+  {
+    return (search_run(argv[2], argv + 3, argc - 3, 0, NULL) < 0) ? 1 : 0;
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--check") == 0)
+  {
+    double timeoutMs = 0;
+    int first = 2;
+
+    if (argc >= 4 && strcmp(argv[2], "--timeout") == 0)
+    {
+      timeoutMs = atof(argv[3]);
+      first = 4;
+    }
+
+    return (batch_check(argv + first, argc - first, 0, timeoutMs) > 0) ? 1 : 0;
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--bench-intern") == 0)
+  {
+    intern_benchmark(argv + 2, argc - 2, 64);
+    return 0;
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--bench") == 0)
+  {
+    bool perf = false;
+    int repeats = 5;
+    int first = 2;
+
+    while (first < argc)
+    {
+      if (strcmp(argv[first], "--perf") == 0)
+        perf = true;
+      else if (strcmp(argv[first], "--repeat") == 0 && first + 1 < argc)
+        repeats = atoi(argv[++first]);
+      else
+        break;
+
+      first++;
+    }
+
+    return (bench_run(argv + first, argc - first, repeats, perf) > 0) ? 1 : 0;
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--bench-python") == 0)
+  {
+    int kilobytes = 512;
+    int repeats = 3;
+
+    for (int i = 2; i + 1 < argc; i += 2)
+    {
+      if (strcmp(argv[i], "--size") == 0)
+        kilobytes = atoi(argv[i + 1]);
+      else if (strcmp(argv[i], "--repeat") == 0)
+        repeats = atoi(argv[i + 1]);
+    }
+
+    return bench_compare(kilobytes, repeats);
+  }
+
+  if (argc >= 2 && strcmp(argv[1], "--stress") == 0)
+  {
+    long maxBytes = 0;
+
+    if (argc >= 4 && strcmp(argv[2], "--max") == 0)
+      maxBytes = atol(argv[3]) * 1024;
+
+    return (stress_run(maxBytes) > 0) ? 1 : 0;
+  }
+
+  if (argc == 3 && strcmp(argv[1], "--shm-consume") == 0)
+  {
+    return shmtokens_consume(argv[2]);
+  }
+
+  if (argc >= 3 && strcmp(argv[1], "--shm-produce") == 0)
+  {
+    return (shmtokens_produce(argv[2], argv + 3, argc - 3) > 0) ? 1 : 0;
+  }
+
+  if (argc >= 3 && strcmp(argv[1], "--structscan") == 0)
+  {
+    return (structscan_verify(argv + 2, argc - 2) > 0) ? 1 : 0;
+  }
+
+  if (argc == 2 && strcmp(argv[1], "--repl") == 0)
+  {
+    return repl_run(stdin);
+  }
+
+  if (argc == 2)  // filename given on the command line:
+  {
+    return scanFile(argv[1]);
+  }
+
   // Ask the user for a filename, if they don't enter one
   // then we'll take input from the keyboard:
   char filename[64]; 
@@ -58,38 +352,19 @@ int main(int argc, char* argv[])
   // input the tokens, either from keyboard or the given nuPython 
   // file; the "input" variable controls the source. the scanner will
   // stop and return EOS when the user enters $ or we reach EOF on
-  // the nuPython file:
-
-  int lineNumber = -1;
-  int colNumber = -1;
-  char value[256] = "";
-  struct Token T;
-
-
-  // setup lineNumber, colNumber, and value to start scanning:
-  scanner_init(&lineNumber, &colNumber, value);
+  // the nuPython file. keyboard input goes through the REPL, so each
+  // statement is output as soon as it is complete:
 
   if (keyboardInput)  // take input from keyboard 
   {
     printf("nuPython input (enter $ when you're done)>\n");
-  }
 
-
-  // call scanner to process input token by token until we see ; or $
-  T = scanner_nextToken(input, &lineNumber, &colNumber, value);
-
-  // print tokens!!
-  while (T.id != nuPy_EOS)
-  {
-    printf("Token %d ('%s') @ (%d, %d)\n", T.id, value, T.line, T.col);
-
-
-    T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+    return repl_run(input);
   }
 
 
-  // output that last token
-  printf("Token %d ('%s') @ (%d, %d)\n", T.id, value, T.line, T.col);
+  // print tokens!!
+  printTokens(input);
 
 
   // done
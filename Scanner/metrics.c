@@ -0,0 +1,456 @@
+/*metrics.c*/
+
+//
+// Metrics endpoint: counters and a latency histogram kept in per-thread
+// shards, summed only when scraped, and served in Prometheus text
+// format on a Unix socket by a background thread.
+//
+// The shards are in a shared anonymous mapping made before any fork,
+// so a fork server's children count into them too; a thread claims a
+// shard on first use, and a forked child inherits its parent thread's
+// shard, which is why shard updates are atomic (but uncontended).
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>     // true, false
+#include <stdint.h>      // uint64_t
+#include <string.h>      // memset, strlen, strncmp
+#include <unistd.h>      // close, read, write, unlink
+#include <poll.h>        // poll
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>    // mmap
+#include <sys/stat.h>    // lstat
+#include <sys/socket.h>  // socket, bind, listen, accept
+#include <sys/un.h>      // sockaddr_un
+
+#include "util.h"
+#include "metrics.h"
+
+
+#define MAX_SHARDS      64
+#define BUCKET_COUNT    12
+#define REQUEST_WAIT_MS 100   // time to wait for a scraper's request line
+
+
+//
+// upper bounds of the latency buckets, in seconds (plus +Inf):
+//
+static const double Buckets[BUCKET_COUNT] =
+{
+  0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5
+};
+
+static char* MetricNames[METRIC_COUNT] =
+{
+  "nupy_requests_total",
+  "nupy_scanned_bytes_total",
+  "nupy_scanned_tokens_total",
+  "nupy_scan_errors_total",
+  "nupy_cache_hits_total",
+  "nupy_cache_misses_total"
+};
+
+static char* MetricHelp[METRIC_COUNT] =
+{
+  "Requests served.",
+  "Bytes scanned.",
+  "Tokens scanned.",
+  "Errors found while scanning (unknown tokens).",
+  "Requests answered from the result cache.",
+  "Requests not found in the result cache."
+};
+
+
+//
+// Shard
+//
+// One thread's counters, on cache lines of their own. Latency sums
+// are kept in microseconds so they can be added atomically.
+//
+struct Shard
+{
+  _Alignas(64)
+  atomic_long counters[METRIC_COUNT];
+  atomic_long buckets[BUCKET_COUNT + 1];  // last is +Inf
+  atomic_long latencyCount;
+  atomic_long latencyMicros;
+};
+
+//
+// Region
+//
+// The shared mapping holding every shard.
+//
+struct Region
+{
+  atomic_int   nextShard;
+  struct Shard shards[MAX_SHARDS];
+};
+
+
+static struct Region* Metrics = NULL;
+static _Thread_local struct Shard* MyShard = NULL;
+
+static struct sockaddr_un Address;  // removed at exit
+static pid_t Server;                // the process serving metrics
+
+//
+// bytes in use through the counting allocator; this is per process
+// (a child's allocations die with it), so it isn't sharded:
+//
+static atomic_long BytesInUse = 0;
+static struct Allocator  Counting;
+static struct Allocator* Inner;
+
+
+//
+// counting allocator: prefixes each block with its size, and passes
+// through to the allocator that was installed before it.
+//
+#define HEADER 16  // keeps the block 16-byte aligned
+
+static void* countingAlloc(void* context, size_t size)
+{
+  (void)context;
+
+  char* p = (char*)Inner->alloc(Inner->context, size + HEADER);
+  if (p == NULL)
+    return NULL;
+
+  *(size_t*)p = size;
+  atomic_fetch_add_explicit(&BytesInUse, (long)size, memory_order_relaxed);
+
+  return p + HEADER;
+}
+
+static void* countingRealloc(void* context, void* p, size_t size)
+{
+  if (p == NULL)
+    return countingAlloc(context, size);
+
+  char* block = (char*)p - HEADER;
+  size_t old = *(size_t*)block;
+
+  block = (char*)Inner->realloc(Inner->context, block, size + HEADER);
+  if (block == NULL)
+    return NULL;
+
+  *(size_t*)block = size;
+  atomic_fetch_add_explicit(&BytesInUse, (long)size - (long)old, memory_order_relaxed);
+
+  return block + HEADER;
+}
+
+static void countingFree(void* context, void* p)
+{
+  (void)context;
+
+  char* block = (char*)p - HEADER;
+
+  atomic_fetch_sub_explicit(&BytesInUse, (long)*(size_t*)block, memory_order_relaxed);
+  Inner->free(Inner->context, block);
+}
+
+
+//
+// my_shard
+//
+// Returns the calling thread's shard, claiming one on first use (if
+// there are more threads than shards, the last shard is shared).
+//
+static struct Shard* my_shard(void)
+{
+  if (MyShard == NULL)
+  {
+    int s = atomic_fetch_add(&Metrics->nextShard, 1);
+
+    MyShard = &Metrics->shards[(s < MAX_SHARDS) ? s : MAX_SHARDS - 1];
+  }
+
+  return MyShard;
+}
+
+
+//
+// metrics_count
+//
+// Adds delta to the calling thread's shard of the counter.
+//
+void metrics_count(enum Metric metric, long delta)
+{
+  if (Metrics == NULL)
+    return;
+
+  atomic_fetch_add_explicit(&my_shard()->counters[metric], delta, memory_order_relaxed);
+}
+
+
+//
+// metrics_observe
+//
+// Records a latency in the calling thread's histogram shard.
+//
+void metrics_observe(double ms)
+{
+  if (Metrics == NULL)
+    return;
+
+  struct Shard* S = my_shard();
+  double seconds = ms / 1000.0;
+  int b = 0;
+
+  while (b < BUCKET_COUNT && seconds > Buckets[b])
+    b++;
+
+  atomic_fetch_add_explicit(&S->buckets[b], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&S->latencyCount, 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&S->latencyMicros, (long)(ms * 1000.0), memory_order_relaxed);
+}
+
+
+//
+// render
+//
+// Sums the shards and renders every metric in Prometheus text format.
+//
+static void render(struct StringBuilder* sb)
+{
+  long counters[METRIC_COUNT] = { 0 };
+  long buckets[BUCKET_COUNT + 1] = { 0 };
+  long latencyCount = 0, latencyMicros = 0;
+
+  for (int s = 0; s < MAX_SHARDS; s++)
+  {
+    struct Shard* S = &Metrics->shards[s];
+
+    for (int m = 0; m < METRIC_COUNT; m++)
+      counters[m] += atomic_load_explicit(&S->counters[m], memory_order_relaxed);
+
+    for (int b = 0; b <= BUCKET_COUNT; b++)
+      buckets[b] += atomic_load_explicit(&S->buckets[b], memory_order_relaxed);
+
+    latencyCount += atomic_load_explicit(&S->latencyCount, memory_order_relaxed);
+    latencyMicros += atomic_load_explicit(&S->latencyMicros, memory_order_relaxed);
+  }
+
+  for (int m = 0; m < METRIC_COUNT; m++)
+  {
+    sbAppendFormat(sb, "# HELP %s %s\n# TYPE %s counter\n", MetricNames[m], MetricHelp[m], MetricNames[m]);
+    sbAppend(sb, MetricNames[m]);
+    sbAppend(sb, " ");
+    sbAppendInt(sb, counters[m]);
+    sbAppend(sb, "\n");
+  }
+
+  long lookups = counters[METRIC_CACHE_HITS] + counters[METRIC_CACHE_MISSES];
+
+  sbAppend(sb, "# HELP nupy_cache_hit_ratio Fraction of cache lookups that hit.\n# TYPE nupy_cache_hit_ratio gauge\n");
+  sbAppendFormat(sb, "nupy_cache_hit_ratio %g\n", (lookups > 0) ? (double)counters[METRIC_CACHE_HITS] / lookups : 0.0);
+
+  sbAppend(sb, "# HELP nupy_allocated_bytes Bytes currently allocated by the server process.\n# TYPE nupy_allocated_bytes gauge\n");
+  sbAppend(sb, "nupy_allocated_bytes ");
+  sbAppendInt(sb, atomic_load_explicit(&BytesInUse, memory_order_relaxed));
+  sbAppend(sb, "\n");
+
+  sbAppend(sb, "# HELP nupy_request_duration_seconds Request latency.\n# TYPE nupy_request_duration_seconds histogram\n");
+
+  long cumulative = 0;
+
+  for (int b = 0; b < BUCKET_COUNT; b++)
+  {
+    cumulative += buckets[b];
+    sbAppendFormat(sb, "nupy_request_duration_seconds_bucket{le=\"%g\"} %ld\n", Buckets[b], cumulative);
+  }
+
+  cumulative += buckets[BUCKET_COUNT];
+
+  sbAppendFormat(sb, "nupy_request_duration_seconds_bucket{le=\"+Inf\"} %ld\n", cumulative);
+  sbAppendFormat(sb, "nupy_request_duration_seconds_sum %.6f\n", latencyMicros / 1e6);
+  sbAppendFormat(sb, "nupy_request_duration_seconds_count %ld\n", latencyCount);
+}
+
+
+//
+// write_all
+//
+// Writes the whole buffer, unless the scraper goes away.
+//
+static void write_all(int fd, char* data, size_t length)
+{
+  while (length > 0)
+  {
+    ssize_t n = write(fd, data, length);
+
+    if (n <= 0)
+      return;
+
+    data += n;
+    length -= (size_t)n;
+  }
+}
+
+
+//
+// serve
+//
+// Thread body: answers each connection with the rendered metrics.
+//
+static void* serve(void* arg)
+{
+  int listener = (int)(intptr_t)arg;
+  struct StringBuilder body, response;
+
+  sbInit(&body);
+  sbInit(&response);
+
+  while (true)
+  {
+    int fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+
+    if (fd < 0)
+      continue;
+
+    //
+    // a scraper speaking HTTP sends a request first; a plain client
+    // (e.g. nc -U) may send nothing, so don't wait long:
+    //
+    char request[512];
+    ssize_t n = 0;
+    struct pollfd pfd = { fd, POLLIN, 0 };
+
+    if (poll(&pfd, 1, REQUEST_WAIT_MS) > 0)
+      n = read(fd, request, sizeof(request));
+
+    bool http = (n >= 4 && strncmp(request, "GET ", 4) == 0);
+
+    sbReset(&body);
+    render(&body);
+
+    sbReset(&response);
+
+    if (http)
+      sbAppendFormat(&response,
+        "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", body.length);
+
+    sbAppendBytes(&response, body.data, body.length);
+
+    write_all(fd, response.data, response.length);
+    close(fd);
+  }
+
+  return NULL;
+}
+
+
+//
+// remove_socket
+//
+// atexit handler: removes the socket file, unless this is a forked
+// child exiting normally.
+//
+static void remove_socket(void)
+{
+  if (getpid() == Server)
+    unlink(Address.sun_path);
+}
+
+
+//
+// metrics_countAllocations
+//
+// Installs the counting allocator over the current one; see metrics.h.
+//
+void metrics_countAllocations(void)
+{
+  if (getAllocator() == &Counting)
+    return;
+
+  Inner = getAllocator();
+  Counting.alloc = countingAlloc;
+  Counting.realloc = countingRealloc;
+  Counting.free = countingFree;
+  Counting.context = NULL;
+  setAllocator(&Counting);
+}
+
+
+//
+// metrics_start
+//
+// Sets up the shards and the server thread; see metrics.h.
+//
+bool metrics_start(char* socketPath)
+{
+  if (socketPath == NULL) panic("socketPath is NULL (metrics_start)");
+
+  // the bytes-in-use gauge is only right if every block was counted:
+  if (getAllocator() != &Counting)
+    panic("counting allocator not installed, call metrics_countAllocations first (metrics_start)");
+
+  if (Metrics != NULL)
+    return true;
+
+  if (strlen(socketPath) >= sizeof(Address.sun_path))
+  {
+    printf("**ERROR: socket path '%s' is too long\n", socketPath);
+    return false;
+  }
+
+  memset(&Address, 0, sizeof(Address));
+  Address.sun_family = AF_UNIX;
+  strcpy(Address.sun_path, socketPath);
+
+  //
+  // a socket left over from an earlier run is replaced, anything else
+  // at the path is left alone:
+  //
+  struct stat st;
+
+  if (lstat(socketPath, &st) == 0)
+  {
+    if (!S_ISSOCK(st.st_mode))
+    {
+      printf("**ERROR: '%s' exists and is not a socket\n", socketPath);
+      return false;
+    }
+
+    unlink(socketPath);
+  }
+
+  int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+  if (listener < 0 || bind(listener, (struct sockaddr*)&Address, sizeof(Address)) < 0 || listen(listener, 16) < 0)
+  {
+    printf("**ERROR: unable to listen on '%s'\n", socketPath);
+    if (listener >= 0)
+      close(listener);
+    return false;
+  }
+
+  void* region = mmap(NULL, sizeof(struct Region), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+  if (region == MAP_FAILED)
+  {
+    printf("**ERROR: unable to map metrics\n");
+    close(listener);
+    return false;
+  }
+
+  Metrics = (struct Region*)region;  // zero-filled by mmap
+
+  pthread_t thread;
+
+  if (pthread_create(&thread, NULL, serve, (void*)(intptr_t)listener) != 0)
+    panic("unable to create thread (metrics_start)");
+
+  pthread_detach(thread);
+
+  Server = getpid();
+  atexit(remove_socket);
+
+  return true;
+}
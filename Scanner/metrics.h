@@ -0,0 +1,68 @@
+/*metrics.h*/
+
+#pragma once
+
+#include <stdbool.h>  // bool
+
+
+//
+// Metric
+//
+// The counters exported by the metrics endpoint.
+//
+enum Metric
+{
+  METRIC_REQUESTS,       // requests served
+  METRIC_BYTES,          // bytes scanned
+  METRIC_TOKENS,         // tokens scanned
+  METRIC_ERRORS,         // errors found while scanning (unknown tokens)
+  METRIC_CACHE_HITS,
+  METRIC_CACHE_MISSES,
+  METRIC_COUNT
+};
+
+
+//
+// metrics_start
+//
+// Starts serving metrics in Prometheus text format on a Unix socket at
+// socketPath, from a background thread: each connection is answered
+// with the current values and closed (a request starting with "GET "
+// gets an HTTP response, so curl --unix-socket works too). Counters
+// live in shared memory, so counts made in children forked afterwards
+// are included. A socket left at socketPath is replaced, but any other
+// file there is an error. The socket file is removed at exit. Returns
+// false if the socket could not be set up.
+//
+// metrics_countAllocations must have been called first (this panics
+// otherwise). Until metrics_start is called, the functions below do
+// nothing.
+//
+bool metrics_start(char* socketPath);
+
+//
+// metrics_countAllocations
+//
+// Installs a counting allocator (see setAllocator) that tracks the
+// bytes in use for the metrics. Blocks carry a size header, so a block
+// allocated before this call must never be freed after it: call this
+// first thing in main, before any module runs.
+//
+void metrics_countAllocations(void);
+
+//
+// metrics_count
+//
+// Adds delta to the given counter. Each thread (and forked child)
+// counts into its own cache-line-sized shard, so counting never
+// contends; the shards are only summed when metrics are scraped.
+//
+void metrics_count(enum Metric metric, long delta);
+
+//
+// metrics_observe
+//
+// Records one request latency (in milliseconds) in the latency
+// histogram.
+//
+void metrics_observe(double ms);
@@ -0,0 +1,253 @@
+/*perfcount.c*/
+
+//
+// Hardware performance counters via perf_event_open (using the raw
+// system call, so no library is needed). Each event is opened on its
+// own, so one the CPU doesn't support doesn't take the others with it;
+// off Linux nothing is available and every event reports n/a.
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>   // true, false
+#include <string.h>    // memset, strerror
+#include <errno.h>     // errno
+#include <unistd.h>    // read, close, syscall
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#define HAVE_PERF_EVENTS 1
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+#endif
+
+#include "util.h"
+#include "perfcount.h"
+
+
+struct PerfCounters
+{
+  int         fds[PERF_EVENT_COUNT];  // -1 if unavailable
+  int         open;                   // number of fds >= 0
+  const char* reason;                 // why none could be opened
+};
+
+
+static char* EventNames[PERF_EVENT_COUNT] =
+{
+  "cycles", "instructions", "branch-misses", "L1d-misses", "LLC-misses"
+};
+
+
+#if HAVE_PERF_EVENTS
+
+//
+// open_event
+//
+// Opens one disabled, user-space-only counter for the calling thread;
+// returns the fd, or -1 with errno set.
+//
+static int open_event(enum PerfEvent e)
+{
+  struct perf_event_attr attr;
+
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.disabled = 1;
+  attr.exclude_kernel = 1;  // allowed at perf_event_paranoid 2
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  switch (e)
+  {
+    case PERF_CYCLES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case PERF_INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case PERF_BRANCH_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      break;
+    case PERF_L1D_MISSES:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_L1D
+                  | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                  | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      break;
+    case PERF_LLC_MISSES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CACHE_MISSES;
+      break;
+    default:
+      errno = EINVAL;
+      return -1;
+  }
+
+  return (int)syscall(SYS_perf_event_open, &attr, 0 /*this thread*/, -1 /*any cpu*/, -1 /*no group*/, 0);
+}
+
+#endif
+
+
+//
+// perf_open
+//
+// Opens the counters for the calling thread; see perfcount.h.
+//
+struct PerfCounters* perf_open(void)
+{
+  struct PerfCounters* P = (struct PerfCounters*)allocMemory(sizeof(struct PerfCounters));
+  if (P == NULL) panic("out of memory (perf_open)");
+
+  P->open = 0;
+  P->reason = "not supported on this platform";
+
+  for (int e = 0; e < PERF_EVENT_COUNT; e++)
+  {
+    P->fds[e] = -1;
+
+#if HAVE_PERF_EVENTS
+    P->fds[e] = open_event((enum PerfEvent)e);
+
+    if (P->fds[e] >= 0)
+      P->open++;
+    else if (e == PERF_CYCLES)  // the first failure is the most telling
+      P->reason = (errno == EACCES || errno == EPERM) ? "permission denied, see /proc/sys/kernel/perf_event_paranoid"
+                : (errno == ENOENT || errno == EOPNOTSUPP) ? "no hardware counters (virtual machine?)"
+                : (errno == ENOSYS) ? "perf_event_open not supported by the kernel"
+                : strerror(errno);
+#endif
+  }
+
+  return P;
+}
+
+
+//
+// perf_close
+//
+// Closes the counters and frees the memory.
+//
+void perf_close(struct PerfCounters* P)
+{
+  if (P == NULL)
+    return;
+
+  for (int e = 0; e < PERF_EVENT_COUNT; e++)
+  {
+    if (P->fds[e] >= 0)
+      close(P->fds[e]);
+  }
+
+  freeMemory(P);
+}
+
+
+//
+// perf_available
+//
+// Returns true if at least one counter could be opened.
+//
+bool perf_available(struct PerfCounters* P, const char** reason)
+{
+  if (P->open > 0)
+    return true;
+
+  if (reason != NULL)
+    *reason = P->reason;
+
+  return false;
+}
+
+
+//
+// perf_start
+//
+// Resets and enables the counters.
+//
+void perf_start(struct PerfCounters* P)
+{
+#if HAVE_PERF_EVENTS
+  for (int e = 0; e < PERF_EVENT_COUNT; e++)
+  {
+    if (P->fds[e] < 0)
+      continue;
+
+    ioctl(P->fds[e], PERF_EVENT_IOC_RESET, 0);
+    ioctl(P->fds[e], PERF_EVENT_IOC_ENABLE, 0);
+  }
+#else
+  (void)P;
+#endif
+}
+
+
+//
+// perf_stop
+//
+// Disables the counters and reads them into the sample, scaling each
+// count by enabled/running time in case the kernel multiplexed them.
+//
+void perf_stop(struct PerfCounters* P, struct PerfSample* sample)
+{
+  for (int e = 0; e < PERF_EVENT_COUNT; e++)
+  {
+    sample->counts[e] = 0;
+    sample->valid[e] = false;
+
+#if HAVE_PERF_EVENTS
+    if (P->fds[e] < 0)
+      continue;
+
+    ioctl(P->fds[e], PERF_EVENT_IOC_DISABLE, 0);
+
+    uint64_t values[3];  // value, time enabled, time running
+
+    if (read(P->fds[e], values, sizeof(values)) != (ssize_t)sizeof(values) || values[2] == 0)
+      continue;
+
+    double scale = (double)values[1] / (double)values[2];
+
+    sample->counts[e] = (uint64_t)((double)values[0] * scale);
+    sample->valid[e] = true;
+#else
+    (void)P;
+#endif
+  }
+}
+
+
+//
+// perf_report
+//
+// Outputs the sample per byte and per token; see perfcount.h.
+//
+void perf_report(char* label, struct PerfSample* sample, double bytes, double tokens)
+{
+  if (sample->valid[PERF_CYCLES] && sample->valid[PERF_INSTRUCTIONS] && sample->counts[PERF_CYCLES] > 0)
+    printf("**PERF %s: IPC %.2f\n", label, (double)sample->counts[PERF_INSTRUCTIONS] / (double)sample->counts[PERF_CYCLES]);
+  else
+    printf("**PERF %s: IPC n/a\n", label);
+
+  for (int e = 0; e < PERF_EVENT_COUNT; e++)
+  {
+    if (!sample->valid[e])
+    {
+      printf("**PERF %s: %s n/a\n", label, EventNames[e]);
+      continue;
+    }
+
+    double count = (double)sample->counts[e];
+
+    printf("**PERF %s: %s %.3f/byte %.3f/token\n", label, EventNames[e],
+      (bytes > 0) ? count / bytes : 0.0, (tokens > 0) ? count / tokens : 0.0);
+  }
+}
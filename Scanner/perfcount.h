@@ -0,0 +1,90 @@
+/*perfcount.h*/
+
+#pragma once
+
+#include <stdbool.h>  // bool
+#include <stdint.h>   // uint64_t
+
+
+//
+// PerfEvent
+//
+// The hardware events counted around a measured region.
+//
+enum PerfEvent
+{
+  PERF_CYCLES,
+  PERF_INSTRUCTIONS,
+  PERF_BRANCH_MISSES,
+  PERF_L1D_MISSES,
+  PERF_LLC_MISSES,
+  PERF_EVENT_COUNT
+};
+
+//
+// PerfCounters
+//
+// A set of hardware performance counters for the calling thread,
+// opened with perf_event_open. Counters the kernel or CPU won't
+// provide are simply marked unavailable.
+//
+struct PerfCounters;
+
+//
+// PerfSample
+//
+// Counts accumulated over one measured region; valid[e] is false if
+// event e could not be counted. Counts are scaled up if the kernel had
+// to multiplex the counters.
+//
+struct PerfSample
+{
+  uint64_t counts[PERF_EVENT_COUNT];
+  bool     valid[PERF_EVENT_COUNT];
+};
+
+
+//
+// perf_open
+//
+// Opens the counters for the calling thread; never returns NULL, even
+// if no counter is available (e.g. not Linux, no PMU in a VM, or
+// perf_event_paranoid forbids it). Call perf_close to free.
+//
+struct PerfCounters* perf_open(void);
+
+//
+// perf_close
+//
+// Closes the counters and frees the memory.
+//
+void perf_close(struct PerfCounters* P);
+
+//
+// perf_available
+//
+// Returns true if at least one counter could be opened; if not, and
+// reason is not NULL, *reason is set to a short explanation.
+//
+bool perf_available(struct PerfCounters* P, const char** reason);
+
+//
+// perf_start, perf_stop
+//
+// Reset and enable the counters at the start of a measured region, and
+// disable and read them into the sample at the end.
+//
+void perf_start(struct PerfCounters* P);
+void perf_stop(struct PerfCounters* P, struct PerfSample* sample);
+
+//
+// perf_report
+//
+// Outputs the sample under the given label, per byte and per token of
+// the work done in the region, e.g.
+//
+//   **PERF scanner: cycles 4.120/byte 21.534/token
+//
+// along with the IPC. Unavailable events are reported as n/a.
+//
+void perf_report(char* label, struct PerfSample* sample, double bytes, double tokens);
@@ -0,0 +1,256 @@
+/*repl.c*/
+
+//
+// Statement-at-a-time REPL: rather than scanning the whole input up to
+// the '$' sentinel, each line is scanned as soon as it is entered and
+// each complete statement is processed immediately, so interactive
+// users get feedback per statement.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>  // true, false
+#include <time.h>     // clock_gettime
+#include <unistd.h>   // isatty
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "intern.h"
+#include "repl.h"
+
+
+//
+// Repl
+//
+// State kept alive between inputs.
+//
+struct Repl
+{
+  int                 lineNumber;   // scanner position, carried across lines
+  int                 colNumber;
+
+  struct TokenArray*  pending;      // tokens of the statement being entered
+  int                 depth;        // of '{' ... '}' in the pending statement
+  int                 header;       // keyword of the last header at depth 0
+  bool                hasBody;      // a body has opened at depth 0
+  bool                awaitElse;    // complete unless elif/else follows
+
+  struct InternTable* symbols;
+  int                 statements;
+  struct StringBuilder output;
+};
+
+
+static double now_ms(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  return (ts.tv_sec * 1000.0) + (ts.tv_nsec / 1000000.0);
+}
+
+
+//
+// process
+//
+// Processes the pending statement: interns its identifiers and outputs
+// its tokens followed by the statement summary, then readies the
+// context for the next statement. start is when the line completing
+// the statement was read.
+//
+static void process(struct Repl* R, double start)
+{
+  struct TokenArray* A = R->pending;
+
+  if (A->count == 0)
+    return;
+
+  int before = intern_count(R->symbols);
+
+  sbReset(&R->output);
+
+  for (int i = 0; i < A->count; i++)
+  {
+    struct Token T = A->tokens[i];
+    char* value = tokenarray_value(A, i);
+
+    if (T.id == nuPy_IDENTIFIER)
+      intern_symbol(R->symbols, value);
+
+    sbAppend(&R->output, "Token ");
+    sbAppendInt(&R->output, T.id);
+    sbAppend(&R->output, " ('");
+    sbAppend(&R->output, value);
+    sbAppend(&R->output, "') @ (");
+    sbAppendInt(&R->output, T.line);
+    sbAppend(&R->output, ", ");
+    sbAppendInt(&R->output, T.col);
+    sbAppend(&R->output, ")\n");
+  }
+
+  R->statements++;
+
+  int total = intern_count(R->symbols);
+
+  fwrite(R->output.data, 1, R->output.length, stdout);
+  printf("**STMT %d @ line %d: %d tokens, %d new symbols (%d total), %.3f ms\n",
+    R->statements, A->tokens[0].line, A->count, total - before, total, now_ms() - start);
+  fflush(stdout);
+
+  tokenarray_reset(A);
+  R->depth = 0;
+  R->header = nuPy_UNKNOWN;
+  R->hasBody = false;
+  R->awaitElse = false;
+}
+
+
+//
+// add_token
+//
+// Appends a token to the pending statement, tracking braces and the
+// header keyword at depth 0.
+//
+static void add_token(struct Repl* R, struct Token T, char* value)
+{
+  if (R->depth == 0 && (T.id == nuPy_KEYW_IF || T.id == nuPy_KEYW_ELIF ||
+                        T.id == nuPy_KEYW_ELSE || T.id == nuPy_KEYW_WHILE))
+    R->header = T.id;
+
+  if (T.id == nuPy_LEFT_BRACE)
+  {
+    if (R->depth == 0)
+      R->hasBody = true;
+    R->depth++;
+  }
+  else if (T.id == nuPy_RIGHT_BRACE)
+    R->depth--;
+
+  tokenarray_append(R->pending, T, value);
+}
+
+
+//
+// end_of_line
+//
+// Decides, at the end of a line, whether the pending statement is
+// complete, and processes it if so.
+//
+static void end_of_line(struct Repl* R, double start)
+{
+  if (R->pending->count == 0)
+    return;
+
+  if (R->depth < 0)  // stray '}', let the parser complain
+  {
+    process(R, start);
+    return;
+  }
+
+  if (R->depth > 0)  // inside a body
+    return;
+
+  int last = R->pending->ids[R->pending->count - 1];
+
+  if (last == nuPy_COLON)  // a header, its body follows
+    return;
+
+  if (!R->hasBody)  // simple statement
+    process(R, start);
+  else if (R->header == nuPy_KEYW_IF || R->header == nuPy_KEYW_ELIF)
+    R->awaitElse = true;
+  else
+    process(R, start);
+}
+
+
+//
+// repl_run
+//
+// Runs the REPL; see repl.h.
+//
+int repl_run(FILE* input)
+{
+  if (input == NULL) panic("input is NULL (repl_run)");
+
+  struct Repl R;
+  char value[SCANNER_MAX_VALUE];
+
+  scanner_init(&R.lineNumber, &R.colNumber, value);
+
+  R.pending = tokenarray_create();
+  R.depth = 0;
+  R.header = nuPy_UNKNOWN;
+  R.hasBody = false;
+  R.awaitElse = false;
+  R.symbols = intern_create(12);
+  R.statements = 0;
+  sbInit(&R.output);
+
+  bool prompt = isatty(fileno(input)) && isatty(fileno(stdout));
+  bool done = false;
+
+  char* line = NULL;
+  size_t capacity = 0;
+  ssize_t length;
+
+  while (!done)
+  {
+    if (prompt)
+    {
+      printf((R.pending->count == 0) ? ">>> " : "... ");
+      fflush(stdout);
+    }
+
+    if ((length = getline(&line, &capacity, input)) < 0)
+      break;
+
+    double start = now_ms();
+
+    FILE* stream = fmemopen(line, (size_t)length, "r");
+    if (stream == NULL) panic("unable to open memory stream (repl_run)");
+
+    struct Token T = scanner_nextToken(stream, &R.lineNumber, &R.colNumber, value);
+    bool first = true;
+
+    //
+    // a blank line ends an if statement, as does anything but elif/else:
+    //
+    if (R.awaitElse && (T.id == nuPy_EOS || (T.id != nuPy_KEYW_ELIF && T.id != nuPy_KEYW_ELSE)))
+      process(&R, start);
+
+    while (T.id != nuPy_EOS)
+    {
+      add_token(&R, T, value);
+      first = false;
+
+      T = scanner_nextToken(stream, &R.lineNumber, &R.colNumber, value);
+    }
+
+    // EOS before the end of the line is a '$':
+    done = !feof(stream);
+
+    fclose(stream);
+
+    if (!first)
+    {
+      R.awaitElse = false;
+      end_of_line(&R, start);
+    }
+  }
+
+  process(&R, now_ms());  // whatever is left
+
+  printf("**REPL: %d statements, %d distinct symbols\n", R.statements, intern_count(R.symbols));
+
+  free(line);  // allocated by getline
+  sbFree(&R.output);
+  intern_destroy(R.symbols);
+  tokenarray_destroy(R.pending);
+
+  return 0;
+}
@@ -0,0 +1,25 @@
+/*repl.h*/
+
+#pragma once
+
+#include <stdio.h>
+
+
+//
+// repl_run
+//
+// Interactive read-eval-print loop over the given input stream. Input
+// is read a line at a time and scanned with one scanner context kept
+// alive throughout (so line numbers run on), and each statement is
+// processed as soon as it is complete: a simple statement at the end
+// of its line, a while/else at its closing '}', and an if/elif once
+// the next line shows no elif or else follows (or a blank line is
+// entered). Processing a statement outputs its tokens and a line
+//
+//   **STMT n @ line L: T tokens, S new symbols (N total), X ms
+//
+// with the latency from reading the completing line. Identifiers are
+// interned into one table shared by all statements. The loop ends at
+// '$' or end of input. Returns 0.
+//
+int repl_run(FILE* input);
@@ -8,6 +8,71 @@
 
 #include "util.h"
 #include "scanner.h"
+#include "flightrec.h"
+
+
+//
+// where this thread's warnings go, NULL for stdout (or the handler, if
+// one is set), and how many it has output:
+//
+static _Thread_local FILE* Warnings = NULL;
+static _Thread_local void (*WarningHandler)(void* arg, int line, int col) = NULL;
+static _Thread_local void* WarningArg = NULL;
+static _Thread_local long  WarningCount = 0;
+
+
+//
+// scanner_setWarnings
+//
+// Directs the calling thread's warnings; see scanner.h.
+//
+void scanner_setWarnings(FILE* stream)
+{
+  Warnings = stream;
+}
+
+
+//
+// scanner_setWarningHandler
+//
+// Passes the calling thread's warnings to a handler; see scanner.h.
+//
+void scanner_setWarningHandler(void (*handler)(void* arg, int line, int col), void* arg)
+{
+  WarningHandler = handler;
+  WarningArg = arg;
+}
+
+
+//
+// scanner_warnString
+//
+// Outputs the unterminated string literal warning; see scanner.h.
+//
+void scanner_warnString(int line, int col)
+{
+  WarningCount++;
+
+  if (WarningHandler != NULL)
+  {
+    WarningHandler(WarningArg, line, col);
+    return;
+  }
+
+  fprintf((Warnings != NULL) ? Warnings : stdout,
+    "**WARNING: string literal @ (%d, %d) not terminated properly\n", line, col);
+}
+
+
+//
+// scanner_warningCount
+//
+// Returns the number of warnings output on this thread; see scanner.h.
+//
+long scanner_warningCount(void)
+{
+  return WarningCount;
+}
 
 
 //
@@ -37,7 +102,8 @@ void scanner_init(int* lineNumber, int* colNumber, char* value)
 // collect_identifier
 //
 // Given the start of an identifier, collects the rest into value
-// while advancing the column number.
+// while advancing the column number. The whole identifier is
+// consumed, but the value is truncated to SCANNER_MAX_VALUE-1 chars.
 //
 static void collect_identifier(FILE* input, int c, int* colNumber, char* value)
 {
@@ -47,8 +113,11 @@ static void collect_identifier(FILE* input, int c, int* colNumber, char* value)
 
   while (isalnum(c) || c == '_')  // letter, digit, or underscore
   {
-    value[i] = (char)c; 
-    i++;
+    if (i < SCANNER_MAX_VALUE - 1)
+    {
+      value[i] = (char)c; 
+      i++;
+    }
 
     (*colNumber)++; 
 
@@ -70,7 +139,8 @@ static void collect_identifier(FILE* input, int c, int* colNumber, char* value)
 //
 // Given the start of a string literal, collects the entire string, 
 // prints termination error if there is a quote mismatch or there is 
-// no termination (new line or EOF)
+// no termination (new line or EOF). The value is truncated to
+// SCANNER_MAX_VALUE-1 chars.
 //
 static void collect_string_literal(FILE* input, int c, int* lineNumber, int* colNumber, char* value) 
 {
@@ -87,7 +157,7 @@ static void collect_string_literal(FILE* input, int c, int* lineNumber, int* col
 
     // new line or EOF, string wasn't terminated properly 
     if (c == EOF || c == '\n') {
-      printf("**WARNING: string literal @ (%d, %d) not terminated properly\n", *lineNumber, col); 
+      scanner_warnString(*lineNumber, col); 
       ungetc(c, input); // push back new line or EOF 
       break; 
     }
@@ -100,14 +170,16 @@ static void collect_string_literal(FILE* input, int c, int* lineNumber, int* col
 
     // quote mismatch, string wasn't terminated properly 
     if (c == '\'' || c=='"') {
-      printf("**WARNING: string literal @ (%d, %d) not terminated properly\n", *lineNumber, col); 
+      scanner_warnString(*lineNumber, col); 
       ungetc(c, input); // push back the mismatched quote (this can be the start of another quote, don't consume now)
       break; 
     }
 
     // store string literal 
-    value[i]=(char)c; 
-    i++; 
+    if (i < SCANNER_MAX_VALUE - 1) {
+      value[i]=(char)c; 
+      i++; 
+    }
     (*colNumber)++; 
   }
 
@@ -118,9 +190,9 @@ static void collect_string_literal(FILE* input, int c, int* lineNumber, int* col
 //
 // collect_int_or_real_literal
 //
-// Given the start of a string literal, collects the entire string, 
-// prints termination error if there is a quote mismatch or there is 
-// no termination (new line or EOF)
+// Given the start of an int or real literal, collects the digits
+// (and any fraction) into value, truncated to SCANNER_MAX_VALUE-1
+// chars, and sets *type to 1 if the literal is real.
 //
 static void collect_int_or_real_literal(FILE* input, int c, int* colNumber, char* value, int* type, bool proceeding) {
   assert (isdigit(c)); //c should be start of int or real literal 
@@ -132,13 +204,17 @@ static void collect_int_or_real_literal(FILE* input, int c, int* colNumber, char
   while (true) {
     if (c == '.') {
       *type=1; // real literal, so let caller know 
-      value[i]=(char)c; // consume and advance past .
-      i++; 
+      if (i < SCANNER_MAX_VALUE - 1) {
+        value[i]=(char)c; // consume and advance past .
+        i++; 
+      }
       (*colNumber)++; 
       c=fgetc(input); 
       while (isdigit(c)) { // collect digits to the right of .
-        value[i]=(char)c; 
-        i++; 
+        if (i < SCANNER_MAX_VALUE - 1) {
+          value[i]=(char)c; 
+          i++; 
+        }
         (*colNumber)++; 
         c=fgetc(input);  
       }
@@ -147,8 +223,10 @@ static void collect_int_or_real_literal(FILE* input, int c, int* colNumber, char
     if (!isdigit(c)) {
       break; 
     }
-    value[i]=(char)c; 
-    i++; 
+    if (i < SCANNER_MAX_VALUE - 1) {
+      value[i]=(char)c; 
+      i++; 
+    }
     (*colNumber)++; 
     c=fgetc(input); 
   }
@@ -159,6 +237,8 @@ static void collect_int_or_real_literal(FILE* input, int c, int* colNumber, char
 
 // SCANNER: 
 
+static struct Token next_token(FILE* input, int* lineNumber, int* colNumber, char* value);
+
 //
 // scanner_nextToken
 //
@@ -178,6 +258,21 @@ struct Token scanner_nextToken(FILE* input, int* lineNumber, int* colNumber, cha
   if (lineNumber == NULL || colNumber == NULL || value == NULL)
     panic("one or more parameters are NULL (scanner_nextToken)");
 
+  struct Token T = next_token(input, lineNumber, colNumber, value);
+
+  flightrec_record(T.line, T.col, T.id);
+
+  return T;
+}
+
+
+//
+// next_token
+//
+// Scans the next token; see scanner_nextToken.
+//
+static struct Token next_token(FILE* input, int* lineNumber, int* colNumber, char* value)
+{
   struct Token T;
 
   // repeatedly input characters one by one until a token is found:
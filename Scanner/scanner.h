@@ -6,6 +6,16 @@
 #include "token.h"
 
 
+//
+// SCANNER_MAX_VALUE
+//
+// Size of the value buffer passed to the scanner. Longer identifiers,
+// literals and strings are consumed in full, but their value is
+// truncated to SCANNER_MAX_VALUE-1 chars.
+//
+#define SCANNER_MAX_VALUE 256
+
+
 //
 // scanner_init
 //
@@ -24,6 +34,44 @@ void scanner_init(int* lineNumber, int* colNumber, char* value);
 // the actual literal in string form, e.g. "123". For an identifer,
 // the value is the identifer itself, e.g. "print" or "x". For a 
 // string literal such as 'hi there', the value is the contents of the 
-// string literal without the quotes.
+// string literal without the quotes. The value buffer must hold at
+// least SCANNER_MAX_VALUE chars.
 //
 struct Token scanner_nextToken(FILE* input, int* lineNumber, int* colNumber, char* value);
+
+//
+// scanner_setWarnings
+//
+// Directs the warnings the scanner outputs on the calling thread (e.g.
+// an unterminated string literal) to the given stream, or back to
+// stdout if stream is NULL (the default). Lets a thread that buffers
+// its output per input keep each input's warnings with it.
+//
+void scanner_setWarnings(FILE* stream);
+
+//
+// scanner_setWarningHandler
+//
+// Instead of outputting them, passes the warnings on the calling
+// thread to handler(arg, line, col), until the handler is set back to
+// NULL. Lets a caller record each warning with the input it belongs
+// to, e.g. as one of that input's diagnostics.
+//
+void scanner_setWarningHandler(void (*handler)(void* arg, int line, int col), void* arg);
+
+//
+// scanner_warnString
+//
+// Outputs the warning for a string literal starting at (line, col)
+// that isn't terminated properly, to the calling thread's warning
+// handler or stream (see scanner_setWarningHandler, scanner_setWarnings).
+//
+void scanner_warnString(int line, int col);
+
+//
+// scanner_warningCount
+//
+// Returns the number of warnings output so far on the calling thread,
+// so a caller can tell which token a warning came with.
+//
+long scanner_warningCount(void);
@@ -0,0 +1,485 @@
+/*search.c*/
+
+//
+// Token-aware structural search: every file is scanned into a
+// TokenArray, and candidate positions are found by comparing the
+// dense one-byte token ids 16 at a time (SSE2 when available) before
+// the full pattern, including any values, is verified.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>    // true, false
+#include <string.h>     // strcmp, strlen, strcpy, memcpy
+#include <ctype.h>      // isspace
+#include <time.h>       // clock_gettime
+#include <unistd.h>     // sysconf
+#include <pthread.h>
+#include <stdatomic.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // _mm_cmpeq_epi8, _mm_movemask_epi8
+#endif
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "structscan.h"
+#include "tokencache.h"
+#include "search.h"
+
+
+#define MAX_ELEMENTS 32
+#define ANY_TOKEN    (-2)   // pattern element that matches every token
+
+
+//
+// Pattern
+//
+// One element per token to match; value[i] is NULL unless the element
+// was given as quoted text, in which case the token's value must match.
+//
+struct Pattern
+{
+  int   count;
+  int   ids[MAX_ELEMENTS];
+  char* values[MAX_ELEMENTS];
+
+  int   anchor1;   // positions of the (up to) two elements used to
+  int   anchor2;   // find candidates; -1 if there is no such element
+};
+
+//
+// Search
+//
+// Shared state of a search: the pattern, the files, the next file
+// to claim, and each file's output (collected so it can be printed
+// in file order).
+//
+struct Search
+{
+  struct Pattern* pattern;
+  char**          files;
+  int             fileCount;
+  char*           cacheDir;   // NULL if not caching tokens
+  atomic_int      nextFile;
+  atomic_int      matches;
+  atomic_int      cached;     // files whose tokens came from the cache
+  char**          output;
+  size_t*         outputLength;
+};
+
+
+static struct
+{
+  char* name;
+  int   id;
+} TokenNames[] = {
+  {"UNKNOWN", nuPy_UNKNOWN}, {"EOS", nuPy_EOS},
+  {"LEFT_PAREN", nuPy_LEFT_PAREN}, {"RIGHT_PAREN", nuPy_RIGHT_PAREN},
+  {"LEFT_BRACKET", nuPy_LEFT_BRACKET}, {"RIGHT_BRACKET", nuPy_RIGHT_BRACKET},
+  {"LEFT_BRACE", nuPy_LEFT_BRACE}, {"RIGHT_BRACE", nuPy_RIGHT_BRACE},
+  {"PLUS", nuPy_PLUS}, {"MINUS", nuPy_MINUS}, {"ASTERISK", nuPy_ASTERISK},
+  {"POWER", nuPy_POWER}, {"PERCENT", nuPy_PERCENT}, {"SLASH", nuPy_SLASH},
+  {"EQUAL", nuPy_EQUAL}, {"EQUALEQUAL", nuPy_EQUALEQUAL}, {"NOTEQUAL", nuPy_NOTEQUAL},
+  {"LT", nuPy_LT}, {"LTE", nuPy_LTE}, {"GT", nuPy_GT}, {"GTE", nuPy_GTE},
+  {"AMPERSAND", nuPy_AMPERSAND}, {"COLON", nuPy_COLON},
+  {"INT_LITERAL", nuPy_INT_LITERAL}, {"REAL_LITERAL", nuPy_REAL_LITERAL},
+  {"STR_LITERAL", nuPy_STR_LITERAL}, {"IDENTIFIER", nuPy_IDENTIFIER},
+  {"KEYW_AND", nuPy_KEYW_AND}, {"KEYW_BREAK", nuPy_KEYW_BREAK},
+  {"KEYW_CONTINUE", nuPy_KEYW_CONTINUE}, {"KEYW_DEF", nuPy_KEYW_DEF},
+  {"KEYW_ELIF", nuPy_KEYW_ELIF}, {"KEYW_ELSE", nuPy_KEYW_ELSE},
+  {"KEYW_FALSE", nuPy_KEYW_FALSE}, {"KEYW_FOR", nuPy_KEYW_FOR},
+  {"KEYW_IF", nuPy_KEYW_IF}, {"KEYW_IN", nuPy_KEYW_IN}, {"KEYW_IS", nuPy_KEYW_IS},
+  {"KEYW_NONE", nuPy_KEYW_NONE}, {"KEYW_NOT", nuPy_KEYW_NOT}, {"KEYW_OR", nuPy_KEYW_OR},
+  {"KEYW_PASS", nuPy_KEYW_PASS}, {"KEYW_RETURN", nuPy_KEYW_RETURN},
+  {"KEYW_TRUE", nuPy_KEYW_TRUE}, {"KEYW_WHILE", nuPy_KEYW_WHILE},
+  {"ANY", ANY_TOKEN}
+};
+
+
+//
+// scan_quoted
+//
+// Scans the given text, which must form exactly one token; returns
+// false if it doesn't. The token's id and value are returned via
+// the parameters.
+//
+static bool scan_quoted(char* text, int* id, char* value)
+{
+  struct TokenArray* A = tokenarray_create();
+
+  structscan_scan(A, text, strlen(text));
+
+  // exactly one token, then EOS:
+  bool single = (A->count == 2 && A->ids[0] != nuPy_EOS);
+
+  *id = A->ids[0];
+  strcpy(value, tokenarray_value(A, 0));
+
+  tokenarray_destroy(A);
+
+  return single;
+}
+
+
+//
+// pattern_parse
+//
+// Parses the textual pattern; outputs an error message and returns
+// false if it's invalid.
+//
+static bool pattern_parse(char* text, struct Pattern* P)
+{
+  P->count = 0;
+
+  char* cp = text;
+
+  while (true)
+  {
+    while (isspace((unsigned char)*cp))
+      cp++;
+
+    if (*cp == '\0')
+      break;
+
+    if (P->count == MAX_ELEMENTS)
+    {
+      printf("**ERROR: pattern has more than %d elements\n", MAX_ELEMENTS);
+      return false;
+    }
+
+    char* start = cp;
+    char element[256];
+
+    if (*cp == '\'' || *cp == '"')  // quoted, runs to the matching quote:
+    {
+      char quote = *cp;
+      cp = strchr(cp + 1, quote);
+
+      if (cp == NULL || cp - start - 1 >= (int)sizeof(element))
+      {
+        printf("**ERROR: bad quoted element in pattern: %s\n", start);
+        return false;
+      }
+
+      int L = (int)(cp - start - 1);
+      memcpy(element, start + 1, L);
+      element[L] = '\0';
+      cp++;
+
+      char value[SCANNER_MAX_VALUE];
+      int id;
+
+      if (!scan_quoted(element, &id, value))
+      {
+        printf("**ERROR: pattern element '%s' is not a single token\n", element);
+        return false;
+      }
+
+      P->ids[P->count] = id;
+      P->values[P->count] = dupString(value);
+    }
+    else  // token kind name:
+    {
+      while (*cp != '\0' && !isspace((unsigned char)*cp))
+        cp++;
+
+      int L = (int)(cp - start);
+      if (L >= (int)sizeof(element))
+        L = (int)sizeof(element) - 1;
+
+      memcpy(element, start, L);
+      element[L] = '\0';
+
+      int id = nuPy_EOS - 100;  // not found
+
+      for (size_t i = 0; i < sizeof(TokenNames) / sizeof(TokenNames[0]); i++)
+      {
+        if (strcmp(TokenNames[i].name, element) == 0)
+          id = TokenNames[i].id;
+      }
+
+      if (id == nuPy_EOS - 100)
+      {
+        printf("**ERROR: unknown token kind '%s' in pattern\n", element);
+        return false;
+      }
+
+      P->ids[P->count] = id;
+      P->values[P->count] = NULL;
+    }
+
+    P->count++;
+  }
+
+  if (P->count == 0)
+  {
+    printf("**ERROR: empty pattern\n");
+    return false;
+  }
+
+  P->anchor1 = -1;
+  P->anchor2 = -1;
+
+  for (int i = 0; i < P->count; i++)
+  {
+    if (P->ids[i] == ANY_TOKEN)
+      continue;
+
+    if (P->anchor1 < 0)
+      P->anchor1 = i;
+    else if (P->anchor2 < 0)
+      P->anchor2 = i;
+  }
+
+  return true;
+}
+
+
+//
+// verify
+//
+// Returns true if the complete pattern matches starting at token i.
+//
+static bool verify(struct Pattern* P, struct TokenArray* A, int i)
+{
+  for (int k = 0; k < P->count; k++)
+  {
+    if (P->ids[k] == ANY_TOKEN)
+      continue;
+
+    if (A->ids[i + k] != P->ids[k])
+      return false;
+
+    if (P->values[k] != NULL && strcmp(tokenarray_value(A, i + k), P->values[k]) != 0)
+      return false;
+  }
+
+  return true;
+}
+
+
+//
+// report
+//
+// Outputs the match at token i of the given file.
+//
+static void report(FILE* output, char* filename, struct Pattern* P, struct TokenArray* A, int i)
+{
+  fprintf(output, "%s:%d:%d:", filename, A->tokens[i].line, A->tokens[i].col);
+
+  for (int k = 0; k < P->count; k++)
+    fprintf(output, " %s", tokenarray_value(A, i + k));
+
+  fprintf(output, "\n");
+}
+
+
+//
+// search_tokens
+//
+// Finds every match in the token array. Candidates are the positions
+// where the anchor elements' ids match; with SSE2 these are found 16
+// positions at a time and the rest of the pattern is then verified.
+//
+static int search_tokens(struct Pattern* P, struct TokenArray* A, char* filename, FILE* output)
+{
+  //
+  // a match ends before the final EOS, unless the pattern ends with an
+  // explicit EOS element (ANY doesn't match it):
+  //
+  int tokens = (P->ids[P->count - 1] == nuPy_EOS) ? A->count : A->count - 1;
+  int limit = tokens - P->count + 1;  // last start position + 1
+  int matches = 0;
+  int i = 0;
+
+  if (P->anchor1 < 0)  // all ANY, every position matches
+  {
+    for (; i < limit; i++)
+    {
+      report(output, filename, P, A, i);
+      matches++;
+    }
+    return matches;
+  }
+
+#if defined(__SSE2__)
+  {
+    //
+    // ids is padded, so reading 16 ids from any start position below
+    // limit stays within the array:
+    //
+    __m128i id1 = _mm_set1_epi8((char)P->ids[P->anchor1]);
+    __m128i id2 = _mm_set1_epi8((char)((P->anchor2 >= 0) ? P->ids[P->anchor2] : 0));
+
+    for (; i + 16 <= limit; i += 16)
+    {
+      __m128i block1 = _mm_loadu_si128((const __m128i*)(A->ids + i + P->anchor1));
+      unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block1, id1));
+
+      if (mask != 0 && P->anchor2 >= 0)
+      {
+        __m128i block2 = _mm_loadu_si128((const __m128i*)(A->ids + i + P->anchor2));
+        mask &= (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(block2, id2));
+      }
+
+      while (mask != 0)
+      {
+        int j = i + __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        if (verify(P, A, j))
+        {
+          report(output, filename, P, A, j);
+          matches++;
+        }
+      }
+    }
+  }
+#endif
+
+  for (; i < limit; i++)  // the remainder (or everything without SSE2):
+  {
+    if (A->ids[i + P->anchor1] == P->ids[P->anchor1] && verify(P, A, i))
+    {
+      report(output, filename, P, A, i);
+      matches++;
+    }
+  }
+
+  return matches;
+}
+
+
+//
+// search_worker
+//
+// Thread body: repeatedly claims the next unsearched file, scans it,
+// and searches its tokens, until no files remain. Everything a file
+// produces, the scanner's warnings included, goes to its own output.
+//
+static void* search_worker(void* arg)
+{
+  struct Search* S = (struct Search*)arg;
+
+  while (true)
+  {
+    int f = atomic_fetch_add(&S->nextFile, 1);
+    if (f >= S->fileCount)
+      break;
+
+    FILE* output = open_memstream(&S->output[f], &S->outputLength[f]);
+    if (output == NULL) panic("out of memory (search_worker)");
+
+    struct TokenArray* A = tokenarray_create();
+    bool hit;
+
+    // the file's warnings go with its results, not straight to stdout:
+    scanner_setWarnings(output);
+
+    bool scanned = tokencache_scanFile(A, S->files[f], S->cacheDir, &hit);
+
+    scanner_setWarnings(NULL);
+
+    if (!scanned)
+    {
+      fprintf(output, "**ERROR: unable to open input file '%s' for input.\n", S->files[f]);
+      fclose(output);
+      tokenarray_destroy(A);
+      continue;
+    }
+
+    if (hit)
+      atomic_fetch_add(&S->cached, 1);
+
+    int n = search_tokens(S->pattern, A, S->files[f], output);
+    atomic_fetch_add(&S->matches, n);
+
+    tokenarray_destroy(A);
+    fclose(output);
+  }
+
+  return NULL;
+}
+
+
+//
+// search_run
+//
+// Parses the pattern, searches the files using the given number of
+// threads, and outputs the matches in file order.
+//
+int search_run(char* pattern, char** files, int fileCount, int threads, char* cacheDir)
+{
+  if (pattern == NULL || (files == NULL && fileCount > 0))
+    panic("one or more parameters are NULL (search_run)");
+
+  struct Pattern P;
+
+  if (!pattern_parse(pattern, &P))
+    return -1;
+
+  if (threads <= 0)
+    threads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+  if (threads > fileCount)
+    threads = fileCount;
+  if (threads < 1)
+    threads = 1;
+
+  struct Search S;
+
+  S.pattern = &P;
+  S.files = files;
+  S.fileCount = fileCount;
+  S.cacheDir = cacheDir;
+  atomic_init(&S.nextFile, 0);
+  atomic_init(&S.matches, 0);
+  atomic_init(&S.cached, 0);
+  S.output = (char**)callocMemory((size_t)fileCount + 1, sizeof(char*));
+  S.outputLength = (size_t*)callocMemory((size_t)fileCount + 1, sizeof(size_t));
+  if (S.output == NULL || S.outputLength == NULL) panic("out of memory (search_run)");
+
+  struct timespec start, stop;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pthread_t* workers = (pthread_t*)allocMemory(sizeof(pthread_t) * threads);
+  if (workers == NULL) panic("out of memory (search_run)");
+
+  for (int t = 0; t < threads; t++)
+  {
+    if (pthread_create(&workers[t], NULL, search_worker, &S) != 0)
+      panic("unable to create thread (search_run)");
+  }
+
+  for (int t = 0; t < threads; t++)
+    pthread_join(workers[t], NULL);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    if (S.output[f] != NULL)
+      fwrite(S.output[f], 1, S.outputLength[f], stdout);
+    free(S.output[f]);  // allocated by open_memstream
+  }
+
+  double ms = (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_nsec - start.tv_nsec) / 1000000.0;
+  int matches = atomic_load(&S.matches);
+
+  printf("**SEARCH: %d matches in %d files (%.3f ms, %d threads)\n", matches, fileCount, ms, threads);
+
+  if (cacheDir != NULL)
+    printf("**SEARCH: %d of %d files from the token cache\n", atomic_load(&S.cached), fileCount);
+
+  for (int k = 0; k < P.count; k++)
+    freeMemory(P.values[k]);
+
+  freeMemory(workers);
+  freeMemory(S.output);
+  freeMemory(S.outputLength);
+
+  return matches;
+}
@@ -0,0 +1,32 @@
+/*search.h*/
+
+#pragma once
+
+
+//
+// search_run
+//
+// Token-aware structural search. The pattern is a whitespace-separated
+// sequence of elements, each of which matches one token:
+//
+//   IDENTIFIER, LEFT_PAREN, KEYW_IF, ...   any token of that kind (the
+//                                          enum name without "nuPy_")
+//   ANY                                    any token
+//   '=' or 'print' or "'hi'"               the token the quoted text
+//                                          scans to, with the same value
+//
+// For example:  IDENTIFIER '=' IDENTIFIER '('
+//
+// Since matching is over tokens, text inside string literals and
+// comments never matches. The files are scanned and searched by the
+// given number of threads (<= 0 means one per CPU), and each match is
+// output as "file:line:col: tokens" in file order, each file's scanner
+// warnings just before its matches.
+//
+// If cacheDir is not NULL, each file's tokens are kept in a token
+// cache there (see tokencache_scanFile), so unchanged files aren't
+// rescanned by later searches.
+//
+// Returns the number of matches, or -1 if the pattern is invalid.
+//
+int search_run(char* pattern, char** files, int fileCount, int threads, char* cacheDir);
@@ -0,0 +1,663 @@
+/*shmtokens.c*/
+
+//
+// Zero-copy token handoff between processes. The producer scans each
+// file straight into a memfd-backed segment (the token array's arrays
+// are laid out in the mapping, sized for the most tokens the file can
+// hold), seals it, and passes the fd over a Unix socket (SCM_RIGHTS);
+// the consumer maps the segment read-only and reads the tokens in
+// place, so the tokens are never copied. A SOCK_SEQPACKET socket keeps
+// each fd paired with its name.
+//
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>     // true, false
+#include <stdint.h>      // int32_t, uint64_t
+#include <limits.h>      // INT_MAX
+#include <string.h>      // memcpy, memset, strlen
+#include <assert.h>      // assert
+#include <fcntl.h>       // fcntl, F_ADD_SEALS
+#include <unistd.h>      // close, ftruncate, unlink
+#include <sys/mman.h>    // mmap, munmap, memfd_create
+#include <sys/socket.h>  // socket, sendmsg, recvmsg
+#include <sys/stat.h>    // fstat, lstat
+#include <sys/un.h>      // sockaddr_un
+
+#if defined(__linux__) && defined(MFD_ALLOW_SEALING) && defined(F_ADD_SEALS)
+#define HAVE_MEMFD 1
+#endif
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "shmtokens.h"
+
+
+#define SHM_ALIGN 64       // each array starts on a cache line
+#define MAX_NAME  4096
+
+#define SEALS (F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL)
+
+
+//
+// ShmHeader
+//
+// Start of a segment; offsets are from the start of the segment. The
+// ids array keeps its TOKENARRAY_PADDING bytes.
+//
+struct ShmHeader
+{
+  char     magic[8];  // "NUPYSHM1"
+  int32_t  count;
+  int32_t  textLength;
+  uint64_t idsOffset;
+  uint64_t tokensOffset;
+  uint64_t valuesOffset;
+  uint64_t textOffset;
+  uint64_t length;     // of the whole segment
+};
+
+static const char Magic[8] = { 'N', 'U', 'P', 'Y', 'S', 'H', 'M', '1' };
+
+
+static uint64_t align_up(uint64_t n)
+{
+  return (n + SHM_ALIGN - 1) & ~(uint64_t)(SHM_ALIGN - 1);
+}
+
+
+//
+// new_segment
+//
+// Creates a memfd laid out for up to maxTokens tokens and maxText bytes
+// of values, and maps it writable; fills in H (count and textLength
+// left 0) and returns the mapping, or NULL. The ids are set to
+// nuPy_UNKNOWN, padding included.
+//
+static char* new_segment(int maxTokens, int maxText, struct ShmHeader* H, int* fd)
+{
+#if HAVE_MEMFD
+  memset(H, 0, sizeof(*H));
+  memcpy(H->magic, Magic, sizeof(Magic));
+
+  H->idsOffset = align_up(sizeof(*H));
+  H->tokensOffset = align_up(H->idsOffset + (uint64_t)maxTokens + TOKENARRAY_PADDING);
+  H->valuesOffset = align_up(H->tokensOffset + sizeof(struct Token) * (uint64_t)maxTokens);
+  H->textOffset = align_up(H->valuesOffset + sizeof(int) * (uint64_t)maxTokens);
+  H->length = align_up(H->textOffset + (uint64_t)maxText);
+
+  *fd = memfd_create("nupy-tokens", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (*fd < 0)
+    return NULL;
+
+  if (ftruncate(*fd, (off_t)H->length) < 0)
+  {
+    close(*fd);
+    return NULL;
+  }
+
+  char* map = (char*)mmap(NULL, H->length, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  if (map == MAP_FAILED)
+  {
+    close(*fd);
+    return NULL;
+  }
+
+  memset(map + H->idsOffset, nuPy_UNKNOWN, (size_t)maxTokens + TOKENARRAY_PADDING);
+
+  return map;
+#else
+  (void)maxTokens, (void)maxText, (void)H;
+  *fd = -1;
+  return NULL;
+#endif
+}
+
+
+//
+// seal_segment
+//
+// Writes the header, unmaps the segment, trims it to the text actually
+// used (the unused tail of the other arrays is never touched, so it
+// takes no memory) and seals it. Returns the fd, or -1.
+//
+static int seal_segment(char* map, struct ShmHeader* H, int fd)
+{
+#if HAVE_MEMFD
+  uint64_t reserved = H->length;
+
+  H->length = align_up(H->textOffset + (uint64_t)H->textLength);
+
+  memcpy(map, H, sizeof(*H));
+
+  // a writable mapping would make the write seal fail:
+  munmap(map, reserved);
+
+  if (ftruncate(fd, (off_t)H->length) < 0 || fcntl(fd, F_ADD_SEALS, SEALS) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+#else
+  (void)map, (void)H;
+  close(fd);
+  return -1;
+#endif
+}
+
+
+//
+// shmtokens_create
+//
+// Copies the token array into a sealed memfd; see shmtokens.h.
+//
+int shmtokens_create(struct TokenArray* A)
+{
+  if (A == NULL) panic("A is NULL (shmtokens_create)");
+
+  struct ShmHeader H;
+  int fd;
+
+  char* map = new_segment(A->count, A->textLength, &H, &fd);
+  if (map == NULL)
+    return -1;
+
+  H.count = A->count;
+  H.textLength = A->textLength;
+
+  memcpy(map + H.idsOffset, A->ids, (size_t)A->count);
+  memcpy(map + H.tokensOffset, A->tokens, sizeof(struct Token) * (size_t)A->count);
+  memcpy(map + H.valuesOffset, A->values, sizeof(int) * (size_t)A->count);
+  memcpy(map + H.textOffset, A->text, (size_t)A->textLength);
+
+  return seal_segment(map, &H, fd);
+}
+
+
+//
+// shmtokens_scan
+//
+// Scans the input directly into a sealed memfd; see shmtokens.h.
+//
+int shmtokens_scan(char* data, size_t length)
+{
+  if (data == NULL && length > 0) panic("data is NULL (shmtokens_scan)");
+
+  //
+  // every token but EOS consumes at least one char, and no value is
+  // longer than the chars its token consumes (EOS's "$" aside), so:
+  //
+  if (length > INT_MAX / 2 - 2)
+    return -1;
+
+  int maxTokens = (int)length + 1;
+  int maxText = 2 * maxTokens;
+
+  struct ShmHeader H;
+  int fd;
+
+  char* map = new_segment(maxTokens, maxText, &H, &fd);
+  if (map == NULL)
+    return -1;
+
+  //
+  // a token array whose arrays are the segment's, with room for the
+  // most tokens the input can hold, so appending never reallocates:
+  //
+  struct TokenArray A;
+
+  A.ids = (signed char*)(map + H.idsOffset);
+  A.tokens = (struct Token*)(map + H.tokensOffset);
+  A.values = (int*)(map + H.valuesOffset);
+  A.count = 0;
+  A.capacity = maxTokens;
+  A.text = map + H.textOffset;
+  A.textLength = 0;
+  A.textCapacity = maxText;
+  A.allocator = NULL;  // never used, as the arrays never grow
+
+  if (length > 0)
+  {
+    FILE* input = fmemopen(data, length, "r");
+    if (input == NULL) panic("unable to open memory stream (shmtokens_scan)");
+
+    tokenarray_scan(&A, input);
+    fclose(input);
+  }
+  else
+  {
+    struct Token T = { nuPy_EOS, 1, 1 };
+    tokenarray_append(&A, T, "$");
+  }
+
+  assert(A.ids == (signed char*)(map + H.idsOffset) && A.text == map + H.textOffset);
+
+  H.count = A.count;
+  H.textLength = A.textLength;
+
+  return seal_segment(map, &H, fd);
+}
+
+
+//
+// read_file
+//
+// Reads the whole file into memory; returns NULL if it can't be read.
+//
+static char* read_file(char* filename, size_t* length)
+{
+  FILE* input = fopen(filename, "rb");
+  if (input == NULL)
+    return NULL;
+
+  size_t capacity = 4096;
+  char* data = (char*)allocMemory(capacity);
+  if (data == NULL) panic("out of memory (read_file)");
+
+  *length = 0;
+
+  size_t n;
+
+  while ((n = fread(data + *length, 1, capacity - *length, input)) > 0)
+  {
+    *length += n;
+
+    if (*length == capacity)
+    {
+      capacity *= 2;
+      data = (char*)reallocMemory(data, capacity);
+      if (data == NULL) panic("out of memory (read_file)");
+    }
+  }
+
+  fclose(input);
+
+  return data;
+}
+
+
+//
+// shmtokens_send
+//
+// Sends the fd and its name as one message; see shmtokens.h.
+//
+bool shmtokens_send(int socket, int fd, char* name)
+{
+  if (name == NULL) panic("name is NULL (shmtokens_send)");
+
+  size_t length = strlen(name) + 1;
+  if (length > MAX_NAME)
+    length = MAX_NAME;
+
+  struct iovec iov = { name, length };
+
+  union  // aligned buffer for the control message:
+  {
+    struct cmsghdr header;
+    char           buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&control, 0, sizeof(control));
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+  return sendmsg(socket, &msg, 0) == (ssize_t)length;
+}
+
+
+//
+// shmtokens_receive
+//
+// Receives an fd and its name; see shmtokens.h.
+//
+int shmtokens_receive(int socket, char* name, size_t nameSize)
+{
+  if (name == NULL || nameSize == 0) panic("no room for the name (shmtokens_receive)");
+
+  char buffer[MAX_NAME];
+  struct iovec iov = { buffer, sizeof(buffer) };
+
+  union
+  {
+    struct cmsghdr header;
+    char           buffer[CMSG_SPACE(sizeof(int))];
+  } control;
+
+  struct msghdr msg;
+
+  memset(&msg, 0, sizeof(msg));
+
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buffer;
+  msg.msg_controllen = sizeof(control.buffer);
+
+  ssize_t n = recvmsg(socket, &msg, MSG_CMSG_CLOEXEC);
+
+  if (n <= 0)  // end of stream, or failed
+    return -1;
+
+  int fd = -1;
+
+  for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+  {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+  }
+
+  buffer[(size_t)n < sizeof(buffer) ? (size_t)n : sizeof(buffer) - 1] = '\0';
+
+  strncpy(name, buffer, nameSize - 1);
+  name[nameSize - 1] = '\0';
+
+  return fd;
+}
+
+
+//
+// shmtokens_map
+//
+// Maps and validates a segment; see shmtokens.h.
+//
+bool shmtokens_map(int fd, struct SharedTokens* S)
+{
+  if (S == NULL) panic("S is NULL (shmtokens_map)");
+
+#if HAVE_MEMFD
+  // without the seals the producer could change it after we check it:
+  int seals = fcntl(fd, F_GET_SEALS);
+  if (seals < 0 || (seals & (F_SEAL_WRITE | F_SEAL_SHRINK)) != (F_SEAL_WRITE | F_SEAL_SHRINK))
+    return false;
+#endif
+
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct ShmHeader))
+    return false;
+
+  size_t length = (size_t)st.st_size;
+
+  char* map = (char*)mmap(NULL, length, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+    return false;
+
+  struct ShmHeader* H = (struct ShmHeader*)map;
+
+  //
+  // every array must lie within the segment; each offset is checked
+  // before the room after it, so a huge offset can't wrap around (the
+  // sizes can't, count and textLength being 32-bit):
+  //
+  bool ok = memcmp(H->magic, Magic, sizeof(Magic)) == 0
+    && H->count >= 0 && H->textLength >= 0 && H->length <= length
+    && H->idsOffset <= length && (uint64_t)H->count + TOKENARRAY_PADDING <= length - H->idsOffset
+    && H->tokensOffset <= length && sizeof(struct Token) * (uint64_t)H->count <= length - H->tokensOffset
+    && H->valuesOffset <= length && sizeof(int) * (uint64_t)H->count <= length - H->valuesOffset
+    && H->textOffset <= length && (uint64_t)H->textLength <= length - H->textOffset
+    && H->tokensOffset % _Alignof(struct Token) == 0
+    && H->valuesOffset % _Alignof(int) == 0;
+
+  // every value must start within the text, which must end in '\0':
+  if (ok && H->count > 0)
+    ok = H->textLength > 0 && map[H->textOffset + H->textLength - 1] == '\0';
+
+  if (ok)
+  {
+    int* values = (int*)(map + H->valuesOffset);
+
+    for (int i = 0; i < H->count && ok; i++)
+      ok = values[i] >= 0 && values[i] < H->textLength;
+  }
+
+  if (!ok)
+  {
+    munmap(map, length);
+    return false;
+  }
+
+  S->map = map;
+  S->length = length;
+
+  S->tokens.ids = (signed char*)(map + H->idsOffset);
+  S->tokens.tokens = (struct Token*)(map + H->tokensOffset);
+  S->tokens.values = (int*)(map + H->valuesOffset);
+  S->tokens.count = H->count;
+  S->tokens.capacity = H->count;
+  S->tokens.text = map + H->textOffset;
+  S->tokens.textLength = H->textLength;
+  S->tokens.textCapacity = H->textLength;
+  S->tokens.allocator = NULL;
+
+  return true;
+}
+
+
+//
+// shmtokens_unmap
+//
+// Unmaps the segment.
+//
+void shmtokens_unmap(struct SharedTokens* S)
+{
+  if (S == NULL || S->map == NULL)
+    return;
+
+  munmap(S->map, S->length);
+
+  S->map = NULL;
+  S->length = 0;
+}
+
+
+//
+// open_socket
+//
+// Returns a SOCK_SEQPACKET Unix socket and fills in the address for
+// the given path, or returns -1.
+//
+static int open_socket(char* socketPath, struct sockaddr_un* address)
+{
+  if (strlen(socketPath) >= sizeof(address->sun_path))
+  {
+    printf("**ERROR: socket path '%s' is too long\n", socketPath);
+    return -1;
+  }
+
+  memset(address, 0, sizeof(*address));
+  address->sun_family = AF_UNIX;
+  strcpy(address->sun_path, socketPath);
+
+  int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+  if (fd < 0)
+    printf("**ERROR: unable to create socket\n");
+
+  return fd;
+}
+
+
+//
+// remove_socket
+//
+// Removes a socket left at the path by an earlier run. Returns false,
+// and removes nothing, if something other than a socket is there.
+//
+static bool remove_socket(char* socketPath)
+{
+  struct stat st;
+
+  if (lstat(socketPath, &st) < 0)
+    return true;  // nothing there
+
+  if (!S_ISSOCK(st.st_mode))
+  {
+    printf("**ERROR: '%s' exists and is not a socket\n", socketPath);
+    return false;
+  }
+
+  unlink(socketPath);
+
+  return true;
+}
+
+
+//
+// shmtokens_produce
+//
+// Scans the files and sends each one's tokens; see shmtokens.h.
+//
+int shmtokens_produce(char* socketPath, char** files, int fileCount)
+{
+  struct sockaddr_un address;
+
+  int sock = open_socket(socketPath, &address);
+  if (sock < 0)
+    return fileCount;
+
+  if (connect(sock, (struct sockaddr*)&address, sizeof(address)) < 0)
+  {
+    printf("**ERROR: unable to connect to '%s'\n", socketPath);
+    close(sock);
+    return fileCount;
+  }
+
+  int failed = 0;
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    size_t length;
+    char* data = read_file(files[f], &length);
+
+    if (data == NULL)
+    {
+      printf("**ERROR: unable to open input file '%s' for input.\n", files[f]);
+      failed++;
+      continue;
+    }
+
+    int fd = shmtokens_scan(data, length);
+
+    if (fd < 0)
+    {
+      printf("**ERROR: unable to create shared memory for '%s'\n", files[f]);
+      failed++;
+    }
+    else
+    {
+      if (!shmtokens_send(sock, fd, files[f]))
+      {
+        printf("**ERROR: unable to send tokens of '%s'\n", files[f]);
+        failed++;
+      }
+
+      close(fd);  // the consumer has its own reference now
+    }
+
+    freeMemory(data);
+  }
+
+  close(sock);
+
+  return failed;
+}
+
+
+//
+// shmtokens_consume
+//
+// Receives and summarizes segments from one producer; see shmtokens.h.
+//
+int shmtokens_consume(char* socketPath)
+{
+  struct sockaddr_un address;
+
+  if (!remove_socket(socketPath))
+    return 1;
+
+  int listener = open_socket(socketPath, &address);
+  if (listener < 0)
+    return 1;
+
+  if (bind(listener, (struct sockaddr*)&address, sizeof(address)) < 0 || listen(listener, 1) < 0)
+  {
+    printf("**ERROR: unable to listen on '%s'\n", socketPath);
+    close(listener);
+    return 1;
+  }
+
+  printf("**SHM: listening on %s\n", socketPath);
+  fflush(stdout);
+
+  int sock = accept(listener, NULL, NULL);
+
+  close(listener);
+  remove_socket(socketPath);
+
+  if (sock < 0)
+  {
+    printf("**ERROR: unable to accept a producer\n");
+    return 1;
+  }
+
+  char name[MAX_NAME];
+  int fd;
+  int segments = 0;
+
+  while ((fd = shmtokens_receive(sock, name, sizeof(name))) >= 0)
+  {
+    struct SharedTokens S;
+
+    if (!shmtokens_map(fd, &S))
+    {
+      printf("**ERROR: invalid token segment for '%s'\n", name);
+      close(fd);
+      continue;
+    }
+
+    close(fd);  // the mapping stays valid
+
+    //
+    // read the tokens in place:
+    //
+    struct TokenArray* A = &S.tokens;
+    int identifiers = 0, unknown = 0;
+
+    for (int i = 0; i < A->count; i++)
+    {
+      if (A->ids[i] == nuPy_IDENTIFIER)
+        identifiers++;
+      else if (A->ids[i] == nuPy_UNKNOWN)
+        unknown++;
+    }
+
+    printf("**SHM %s: %d tokens (%d identifiers, %d unknown), %zu bytes mapped\n",
+      name, A->count, identifiers, unknown, S.length);
+
+    shmtokens_unmap(&S);
+    segments++;
+  }
+
+  close(sock);
+
+  printf("**SHM: received %d segments\n", segments);
+
+  return 0;
+}
@@ -0,0 +1,102 @@
+/*shmtokens.h*/
+
+#pragma once
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+
+#include "tokenarray.h"
+
+
+//
+// SharedTokens
+//
+// A token array mapped read-only from a shared-memory segment made by
+// another process. The array's pointers refer directly into the
+// mapping, so tokens are read with zero copies; the array must not be
+// modified, appended to or passed to tokenarray_destroy.
+//
+struct SharedTokens
+{
+  struct TokenArray tokens;
+  void*             map;
+  size_t            length;
+};
+
+
+//
+// shmtokens_create
+//
+// Copies the token array (ids, tokens, value offsets and value text)
+// into a new memfd-backed shared-memory segment, seals it so it can no
+// longer change, and returns its fd. Returns -1 if shared memory is
+// unavailable (e.g. not Linux).
+//
+int shmtokens_create(struct TokenArray* A);
+
+//
+// shmtokens_scan
+//
+// Like shmtokens_create, but scans the in-memory input (length bytes)
+// directly into the segment, so the tokens are written once, in place;
+// the segment is sized for the most tokens length bytes can hold and
+// trimmed afterwards. Returns -1 if shared memory is unavailable or
+// the input is too large (over 1GB).
+//
+int shmtokens_scan(char* data, size_t length);
+
+//
+// shmtokens_send
+//
+// Passes the segment's fd over the connected Unix socket, along with a
+// name (e.g. the scanned file's path). Returns false on failure.
+//
+bool shmtokens_send(int socket, int fd, char* name);
+
+//
+// shmtokens_receive
+//
+// Receives a segment fd and its name (truncated to nameSize) from the
+// Unix socket. Returns the fd, or -1 at end of stream or on failure.
+//
+int shmtokens_receive(int socket, char* name, size_t nameSize);
+
+//
+// shmtokens_map
+//
+// Maps the segment read-only and validates it (header, bounds of every
+// array and value offset, and that the segment is sealed against
+// writes). Returns true and fills in S on success; the fd may be
+// closed afterwards. Call shmtokens_unmap when done.
+//
+bool shmtokens_map(int fd, struct SharedTokens* S);
+
+//
+// shmtokens_unmap
+//
+// Unmaps a segment mapped by shmtokens_map.
+//
+void shmtokens_unmap(struct SharedTokens* S);
+
+//
+// shmtokens_produce
+//
+// Scans each of the given files and hands its tokens to the consumer
+// listening on the Unix socket at socketPath. Returns the number of
+// files that could not be scanned or sent.
+//
+int shmtokens_produce(char* socketPath, char** files, int fileCount);
+
+//
+// shmtokens_consume
+//
+// Listens on a Unix socket at socketPath (replacing a socket left there
+// by an earlier run, but never any other kind of file), accepts one
+// producer, and maps each segment it sends, outputting a summary of
+// its tokens:
+//
+//   **SHM name: N tokens (I identifiers, U unknown), B bytes mapped
+//
+// Returns 0 on success, non-zero if the socket could not be set up.
+//
+int shmtokens_consume(char* socketPath);
@@ -0,0 +1,312 @@
+/*stress.c*/
+
+//
+// Pathological-input suite: adversarial generators run at doubling
+// sizes, guarding the scanner against super-linear time or memory and
+// against crashes. Every run happens in its own forked child, with
+// stdout discarded (some inputs produce a warning per line) and an
+// alarm set, so the parent sees crashes and hangs as signals.
+//
+// Only the scanner is exercised: the parser can't be built in this
+// tree (it needs tokenqueue), so the "nested bodies" and "nested
+// parens" inputs check that scanning them stays linear, not the
+// parser's recursion (parser_body, parser_stmts, MAX_NESTING).
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>       // true, false
+#include <string.h>        // strlen, memcpy, strsignal
+#include <time.h>          // clock_gettime
+#include <fcntl.h>         // open
+#include <unistd.h>        // fork, pipe, dup2, alarm
+#include <signal.h>        // SIGALRM
+#include <sys/wait.h>      // waitpid
+#include <sys/resource.h>  // getrusage
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "stress.h"
+
+
+#define MIN_BYTES     (64*1024)
+#define MAX_BYTES     (4*1024*1024)
+#define TIMEOUT_SECS  30     // per run, a hang is reported as a failure
+#define LINEAR_SLACK  3.0    // allowed excess over linear growth
+#define MIN_MS        1.0    // times and sizes below these are noise
+#define MIN_KB        1024
+
+
+//
+// Generator
+//
+// An adversarial input: prefix, then "open" repeated k times, then
+// "close" repeated k times, then suffix, with k chosen to reach the
+// requested size. Nesting uses open/close; most inputs just repeat
+// open and leave close empty.
+//
+struct Generator
+{
+  char* name;
+  char* prefix;
+  char* open;
+  char* close;
+  char* suffix;
+};
+
+static struct Generator Generators[] =
+{
+  { "long identifier",      "",      "a",           "",     "\n" },
+  { "long string",          "\"",    "a",           "",     "\"\n" },
+  { "long integer",         "",      "1",           "",     "\n" },
+  { "long real",            "1.",    "0",           "",     "\n" },
+  { "long comment",         "#",     "x",           "",     "\n" },
+  { "unterminated strings", "",      "\"x\n",       "",     "" },
+  { "mismatched quotes",    "",      "'x\"\n",      "",     "" },
+  { "nested bodies",        "",      "if x:\n{\n",  "}\n",  "" },
+  { "nested parens",        "x = ",  "(",           ")",    "\n" },
+  { "one long line",        "x = ",  "a + ",        "",     "1\n" },
+  { "operator soup",        "",      "<=>=!===**",  "",     "\n" },
+  { "unknown characters",   "",      "@",           "",     "\n" },
+  { "blank lines",          "",      "\n",          "",     "x\n" }
+};
+
+
+//
+// Sample
+//
+// What a child measured for one run.
+//
+struct Sample
+{
+  double ms;
+  long   kilobytes;  // growth in peak memory during the scan
+  long   tokens;
+};
+
+
+//
+// generate
+//
+// Returns a new buffer holding about size bytes of the generator's
+// input (always at least one repetition); *length is set to its length.
+//
+static char* generate(struct Generator* G, long size, size_t* length)
+{
+  size_t prefix = strlen(G->prefix), open = strlen(G->open);
+  size_t close = strlen(G->close), suffix = strlen(G->suffix);
+
+  size_t k = (size_t)size / (open + close);
+  if (k == 0)
+    k = 1;
+
+  *length = prefix + k * (open + close) + suffix;
+
+  char* data = (char*)allocMemory(*length + 1);
+  if (data == NULL) panic("out of memory (generate)");
+
+  char* p = data;
+
+  memcpy(p, G->prefix, prefix);
+  p += prefix;
+
+  for (size_t i = 0; i < k; i++, p += open)
+    memcpy(p, G->open, open);
+
+  for (size_t i = 0; i < k; i++, p += close)
+    memcpy(p, G->close, close);
+
+  memcpy(p, G->suffix, suffix);
+  p += suffix;
+
+  *p = '\0';
+
+  return data;
+}
+
+
+//
+// child_run
+//
+// Child body: generates the input, scans it into a token array and
+// writes the measurements to fd. Never returns.
+//
+static void child_run(struct Generator* G, long size, int fd)
+{
+  int devnull = open("/dev/null", O_WRONLY);
+
+  if (devnull >= 0)
+  {
+    dup2(devnull, STDOUT_FILENO);
+    close(devnull);
+  }
+
+  alarm(TIMEOUT_SECS);
+
+  size_t length;
+  char* data = generate(G, size, &length);
+
+  FILE* input = fmemopen(data, length, "r");
+  if (input == NULL) _exit(2);
+
+  struct rusage before, after;
+  struct timespec start, stop;
+
+  getrusage(RUSAGE_SELF, &before);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  struct TokenArray* A = tokenarray_create();
+  tokenarray_scan(A, input);
+
+  clock_gettime(CLOCK_MONOTONIC, &stop);
+  getrusage(RUSAGE_SELF, &after);
+
+  struct Sample S;
+
+  S.ms = (stop.tv_sec - start.tv_sec) * 1000.0 + (stop.tv_nsec - start.tv_nsec) / 1000000.0;
+  S.kilobytes = after.ru_maxrss - before.ru_maxrss;
+  S.tokens = A->count;
+
+  if (write(fd, &S, sizeof(S)) != (ssize_t)sizeof(S))
+    _exit(2);
+
+  fflush(stdout);
+  _exit(0);
+}
+
+
+//
+// run_case
+//
+// Runs one generator at one size in a forked child. Returns true and
+// fills in the sample if the child finished; otherwise returns false
+// with the reason in failure.
+//
+static bool run_case(struct Generator* G, long size, struct Sample* S, char* failure, size_t failureSize)
+{
+  int fds[2];
+
+  if (pipe(fds) < 0)
+  {
+    snprintf(failure, failureSize, "unable to create pipe");
+    return false;
+  }
+
+  fflush(stdout);  // else the child would output it too
+
+  pid_t pid = fork();
+
+  if (pid < 0)
+  {
+    close(fds[0]);
+    close(fds[1]);
+    snprintf(failure, failureSize, "unable to fork");
+    return false;
+  }
+
+  if (pid == 0)  // child:
+  {
+    close(fds[0]);
+    child_run(G, size, fds[1]);
+  }
+
+  // parent:
+  close(fds[1]);
+
+  ssize_t n = read(fds[0], S, sizeof(*S));
+  close(fds[0]);
+
+  int status;
+  waitpid(pid, &status, 0);
+
+  if (WIFSIGNALED(status))
+  {
+    if (WTERMSIG(status) == SIGALRM)
+      snprintf(failure, failureSize, "hung, killed after %d s at %ld bytes", TIMEOUT_SECS, size);
+    else
+      snprintf(failure, failureSize, "crashed with signal %d (%s) at %ld bytes",
+        WTERMSIG(status), strsignal(WTERMSIG(status)), size);
+    return false;
+  }
+
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || n != (ssize_t)sizeof(*S))
+  {
+    snprintf(failure, failureSize, "exited abnormally at %ld bytes", size);
+    return false;
+  }
+
+  return true;
+}
+
+
+//
+// stress_run
+//
+// Runs the pathological-input suite; see stress.h.
+//
+int stress_run(long maxBytes)
+{
+  if (maxBytes <= 0)
+    maxBytes = MAX_BYTES;
+
+  int generators = (int)(sizeof(Generators) / sizeof(Generators[0]));
+  int failures = 0;
+
+  for (int g = 0; g < generators; g++)
+  {
+    struct Generator* G = &Generators[g];
+    struct Sample first = { 0, 0, 0 }, last = { 0, 0, 0 };
+    long firstSize = 0, lastSize = 0;
+    char failure[256] = "";
+
+    for (long size = MIN_BYTES; size <= maxBytes; size *= 2)
+    {
+      struct Sample S;
+
+      if (!run_case(G, size, &S, failure, sizeof(failure)))
+        break;
+
+      printf("**STRESS %s: %ld bytes, %ld tokens, %.3f ms, %ld KB\n", G->name, size, S.tokens, S.ms, S.kilobytes);
+
+      if (firstSize == 0)
+      {
+        first = S;
+        firstSize = size;
+      }
+
+      last = S;
+      lastSize = size;
+    }
+
+    //
+    // linear growth means the largest run costs about growth times the
+    // smallest; measurements below the noise floor are rounded up:
+    //
+    if (failure[0] == '\0' && firstSize > 0)
+    {
+      double growth = (double)lastSize / (double)firstSize;
+      double time = last.ms / (first.ms > MIN_MS ? first.ms : MIN_MS);
+      double memory = (double)last.kilobytes / (first.kilobytes > MIN_KB ? first.kilobytes : MIN_KB);
+
+      if (time > LINEAR_SLACK * growth)
+        snprintf(failure, sizeof(failure), "time grew x%.1f for x%.0f input, super-linear", time, growth);
+      else if (memory > LINEAR_SLACK * growth)
+        snprintf(failure, sizeof(failure), "memory grew x%.1f for x%.0f input, super-linear", memory, growth);
+      else
+        printf("**STRESS %s: PASS (time x%.1f, memory x%.1f for x%.0f input)\n", G->name, time, memory, growth);
+    }
+
+    if (failure[0] != '\0')
+    {
+      printf("**STRESS %s: FAIL, %s\n", G->name, failure);
+      failures++;
+    }
+  }
+
+  printf("**STRESS: %d of %d generators passed\n", generators - failures, generators);
+
+  return failures;
+}
@@ -0,0 +1,26 @@
+/*stress.h*/
+
+#pragma once
+
+
+//
+// stress_run
+//
+// Runs the pathological-input suite: each adversarial generator (a
+// megabyte-long identifier, thousands of unterminated strings, deeply
+// nested bodies, ...) produces inputs at doubling sizes, each of which
+// is scanned into a token array in a forked child so that a crash or
+// hang is caught and reported rather than taking down the suite. Each
+// run is output as
+//
+//   **STRESS name: bytes, ms, KB
+//
+// and each generator as PASS if time and memory grew at most linearly
+// (within a slack factor) from the smallest to the largest size, or
+// FAIL with the reason. maxBytes <= 0 means the default of 4MB.
+//
+// Only the scanner is run; the parser is not exercised by the suite.
+//
+// Returns the number of generators that failed.
+//
+int stress_run(long maxBytes);
@@ -0,0 +1,709 @@
+/*structscan.c*/
+
+//
+// Two-stage scanner for in-memory inputs, after simdjson. Stage 1
+// classifies the input a block of 64 bytes at a time (with SSE2 where
+// available) into bitmasks of whitespace, newlines, quotes and
+// identifier characters (letters, digits and '_'), and derives from
+// them the structural index: a mask of the bytes that can start a
+// token, i.e. every non-space byte that doesn't continue a run of
+// identifier characters. Stage 2 walks the index from token to token
+// (counting the newlines passed over), finds the end of each
+// identifier and string literal with the masks rather than byte by
+// byte, and emits the tokens; only numbers and operators, a few bytes
+// each, are still examined a byte at a time.
+//
+// Stage 1 runs a window ahead of stage 2 (WINDOW_BLOCKS blocks), so
+// the masks stay in cache; a window is only classified once stage 2
+// reaches it, and windows a long comment spans are skipped.
+//
+// The token rules are those of scanner_nextToken, including its
+// quirks: the opening quote of a string literal doesn't advance the
+// column, a comment advances the line as soon as it starts, and a sign
+// directly followed by a digit is part of the literal.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>    // true, false
+#include <stdint.h>     // uint64_t
+#include <string.h>     // memcpy, memset, memchr, strcmp
+
+#if defined(__SSE2__)
+#include <emmintrin.h>  // _mm_cmpeq_epi8, _mm_movemask_epi8
+#endif
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "cancel.h"
+#include "structscan.h"
+
+
+#define BLOCK_BYTES   64
+#define WINDOW_BLOCKS 256   // stage 1 classifies 16KB at a time
+
+
+//
+// Scan
+//
+// Stage 2's position bookkeeping, and the window of masks computed by
+// stage 1: bit i of masks[m][b] describes the byte at base + 64b + i.
+//
+enum
+{
+  STARTS,    // the structural index: bytes that can start a token
+  NONIDENT,  // bytes that aren't identifier characters
+  STOPS,     // quotes and newlines, either of which ends a string
+  NEWLINES,
+  MASKS
+};
+
+struct Scan
+{
+  unsigned char* data;
+  size_t         length;
+
+  size_t         base;       // first byte of the window (64-aligned)
+  size_t         limit;      // end of the window
+  uint64_t       masks[MASKS][WINDOW_BLOCKS];
+
+  int            line;
+  size_t         lineStart;  // offset of the current line's first byte
+  int            adjust;     // columns on this line not counted (quotes)
+};
+
+
+//
+// the keywords, each in the slot keyword_slot gives it (no two share
+// a slot), so checking an identifier takes one comparison:
+//
+static struct
+{
+  char* name;
+  int   id;
+}
+Keywords[32] =
+{
+  [1]  = { "not", nuPy_KEYW_NOT },
+  [5]  = { "def", nuPy_KEYW_DEF },
+  [7]  = { "while", nuPy_KEYW_WHILE },
+  [9]  = { "elif", nuPy_KEYW_ELIF },
+  [10] = { "and", nuPy_KEYW_AND },
+  [11] = { "None", nuPy_KEYW_NONE },
+  [14] = { "continue", nuPy_KEYW_CONTINUE },
+  [15] = { "pass", nuPy_KEYW_PASS },
+  [16] = { "else", nuPy_KEYW_ELSE },
+  [17] = { "or", nuPy_KEYW_OR },
+  [19] = { "if", nuPy_KEYW_IF },
+  [20] = { "False", nuPy_KEYW_FALSE },
+  [23] = { "for", nuPy_KEYW_FOR },
+  [24] = { "is", nuPy_KEYW_IS },
+  [26] = { "return", nuPy_KEYW_RETURN },
+  [27] = { "in", nuPy_KEYW_IN },
+  [29] = { "True", nuPy_KEYW_TRUE },
+  [30] = { "break", nuPy_KEYW_BREAK }
+};
+
+
+//
+// keyword_slot
+//
+// Returns the slot of Keywords that the identifier of n chars would
+// occupy if it were a keyword.
+//
+static inline unsigned keyword_slot(char* value, size_t n)
+{
+  return ((unsigned char)value[0] * 3u + (unsigned char)value[n - 1] * 25u + (unsigned)n) & 31;
+}
+
+
+//
+// character classes, as isspace / isdigit / isalnum in the C locale
+// (bytes >= 0x80 are in none of them):
+//
+static inline bool is_space(unsigned c)
+{
+  return c == ' ' || c - '\t' <= '\r' - '\t';
+}
+
+static inline bool is_digit(unsigned c)
+{
+  return c - '0' <= 9;
+}
+
+static inline bool is_ident(unsigned c)
+{
+  return (c | 0x20) - 'a' <= 'z' - 'a' || is_digit(c) || c == '_';
+}
+
+
+//
+// classify
+//
+// Stage 1 for one block of 64 bytes: sets the whitespace, newline,
+// quote and identifier character masks.
+//
+static void classify(unsigned char* p, uint64_t* space, uint64_t* newline, uint64_t* quote, uint64_t* ident)
+{
+#if defined(__SSE2__)
+  //
+  // x <= y unsigned is min(x, y) == x; subtracting the low end first
+  // turns each range test into one such comparison (letters are tested
+  // as lowercase, by setting bit 5):
+  //
+  const __m128i tab = _mm_set1_epi8('\t'), ranges = _mm_set1_epi8('\r' - '\t');
+  const __m128i blank = _mm_set1_epi8(' '), eoln = _mm_set1_epi8('\n');
+  const __m128i single = _mm_set1_epi8('\''), dbl = _mm_set1_epi8('"');
+  const __m128i zero = _mm_set1_epi8('0'), nine = _mm_set1_epi8(9);
+  const __m128i lower = _mm_set1_epi8(0x20), a = _mm_set1_epi8('a'), z = _mm_set1_epi8('z' - 'a');
+  const __m128i under = _mm_set1_epi8('_');
+
+  *space = *newline = *quote = *ident = 0;
+
+  for (int k = 0; k < BLOCK_BYTES; k += 16)
+  {
+    __m128i x = _mm_loadu_si128((const __m128i*)(p + k));
+
+    __m128i t = _mm_sub_epi8(x, tab);
+    __m128i s = _mm_or_si128(_mm_cmpeq_epi8(x, blank), _mm_cmpeq_epi8(_mm_min_epu8(t, ranges), t));
+
+    __m128i d = _mm_sub_epi8(x, zero);
+    __m128i l = _mm_sub_epi8(_mm_or_si128(x, lower), a);
+    __m128i w = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(_mm_min_epu8(d, nine), d),
+                                          _mm_cmpeq_epi8(_mm_min_epu8(l, z), l)),
+                             _mm_cmpeq_epi8(x, under));
+
+    __m128i q = _mm_or_si128(_mm_cmpeq_epi8(x, single), _mm_cmpeq_epi8(x, dbl));
+
+    *space |= (uint64_t)(unsigned)_mm_movemask_epi8(s) << k;
+    *newline |= (uint64_t)(unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(x, eoln)) << k;
+    *quote |= (uint64_t)(unsigned)_mm_movemask_epi8(q) << k;
+    *ident |= (uint64_t)(unsigned)_mm_movemask_epi8(w) << k;
+  }
+#else
+  *space = *newline = *quote = *ident = 0;
+
+  for (int k = 0; k < BLOCK_BYTES; k++)
+  {
+    *space |= (uint64_t)is_space(p[k]) << k;
+    *newline |= (uint64_t)(p[k] == '\n') << k;
+    *quote |= (uint64_t)(p[k] == '\'' || p[k] == '"') << k;
+    *ident |= (uint64_t)is_ident(p[k]) << k;
+  }
+#endif
+}
+
+
+//
+// classify_window
+//
+// Stage 1: computes the masks for the window starting at base. An
+// identifier character starts a token unless the byte before it is
+// one too, which for the first byte of a block is the last of the
+// previous block.
+//
+static void classify_window(struct Scan* S, size_t base)
+{
+  size_t end = base + WINDOW_BLOCKS * BLOCK_BYTES;
+
+  if (end > S->length)
+    end = S->length;
+
+  uint64_t carry = (base > 0 && is_ident(S->data[base - 1])) ? 1 : 0;
+  int b = 0;
+
+  for (size_t p = base; p < end; p += BLOCK_BYTES, b++)
+  {
+    uint64_t space, newline, quote, ident;
+
+    if (end - p >= BLOCK_BYTES)
+      classify(S->data + p, &space, &newline, &quote, &ident);
+    else  // the last block, padded with spaces:
+    {
+      unsigned char tail[BLOCK_BYTES];
+
+      memset(tail, ' ', sizeof(tail));
+      memcpy(tail, S->data + p, end - p);
+
+      classify(tail, &space, &newline, &quote, &ident);
+    }
+
+    S->masks[STARTS][b] = ~space & ~(ident & ((ident << 1) | carry));
+    S->masks[NONIDENT][b] = ~ident;
+    S->masks[STOPS][b] = quote | newline;
+    S->masks[NEWLINES][b] = newline;
+
+    carry = ident >> 63;
+  }
+
+  S->base = base;
+  S->limit = end;
+}
+
+
+//
+// window_block
+//
+// Returns the block of the window that holds the byte at pos,
+// classifying the window that starts there if stage 2 has moved past
+// the current one.
+//
+static inline size_t window_block(struct Scan* S, size_t pos)
+{
+  if (pos >= S->limit)
+    classify_window(S, pos & ~(size_t)(BLOCK_BYTES - 1));
+
+  return (pos - S->base) / BLOCK_BYTES;
+}
+
+
+//
+// count_lines
+//
+// Advances the line past the given newlines of block b.
+//
+static inline void count_lines(struct Scan* S, size_t b, uint64_t newlines)
+{
+  if (newlines == 0)
+    return;
+
+  S->line += __builtin_popcountll(newlines);
+  S->lineStart = S->base + b * BLOCK_BYTES + (size_t)(63 - __builtin_clzll(newlines)) + 1;
+  S->adjust = 0;
+}
+
+
+//
+// next_start
+//
+// Stage 2's step along the structural index: returns the offset of the
+// token starting at or after pos (or the length), counting the newlines
+// passed over. A non-space byte at pos starts the next token even if
+// it isn't in the index (the letters right after a number's digits);
+// otherwise the bytes up to the next index entry are all whitespace.
+//
+static inline size_t next_start(struct Scan* S, size_t pos)
+{
+  if (pos < S->length && !is_space(S->data[pos]))
+    return pos;
+
+  while (pos < S->length)
+  {
+    size_t   b = window_block(S, pos);
+    unsigned shift = pos % BLOCK_BYTES;
+    uint64_t starts = (S->masks[STARTS][b] >> shift) << shift;
+    uint64_t newlines = (S->masks[NEWLINES][b] >> shift) << shift;
+
+    if (starts != 0)
+    {
+      unsigned bit = (unsigned)__builtin_ctzll(starts);
+
+      count_lines(S, b, newlines & ((1ULL << bit) - 1));
+
+      return S->base + b * BLOCK_BYTES + bit;
+    }
+
+    count_lines(S, b, newlines);
+
+    pos = S->base + (b + 1) * BLOCK_BYTES;
+  }
+
+  return S->length;
+}
+
+
+//
+// next_in_mask
+//
+// Returns the offset of the first byte at or after pos whose bit is set
+// in the given mask, or the length if there is none.
+//
+static inline size_t next_in_mask(struct Scan* S, size_t pos, int mask)
+{
+  while (pos < S->length)
+  {
+    size_t   b = window_block(S, pos);
+    unsigned shift = pos % BLOCK_BYTES;
+    uint64_t bits = S->masks[mask][b] >> shift;
+
+    if (bits != 0)
+    {
+      pos += (unsigned)__builtin_ctzll(bits);
+      return (pos < S->length) ? pos : S->length;  // padding is past the end
+    }
+
+    pos = S->base + (b + 1) * BLOCK_BYTES;
+  }
+
+  return S->length;
+}
+
+
+//
+// collect_number
+//
+// Collects an int or real literal starting with the digit at pos into
+// value (after the i chars already there); returns the offset after it
+// and sets *real if it has a fraction.
+//
+static size_t collect_number(struct Scan* S, size_t pos, char* value, int i, bool* real)
+{
+  unsigned char* data = S->data;
+  size_t length = S->length;
+
+  *real = false;
+
+  while (pos < length && (is_digit(data[pos]) || (data[pos] == '.' && !*real)))
+  {
+    if (data[pos] == '.')
+      *real = true;
+
+    if (i < SCANNER_MAX_VALUE - 1)
+      value[i++] = (char)data[pos];
+
+    pos++;
+
+    if (*real && (pos >= length || !is_digit(data[pos])))
+      break;
+  }
+
+  value[i] = '\0';
+
+  return pos;
+}
+
+
+//
+// collect_string
+//
+// Collects the string literal whose opening quote is at pos into value;
+// returns the offset after it, warning if it isn't terminated (by the
+// end of the line or input, or the other kind of quote, which is left
+// to start the next token). The end is found with the stop mask.
+//
+static size_t collect_string(struct Scan* S, size_t pos, struct Token T, char* value)
+{
+  unsigned char quote = S->data[pos];
+  size_t end = next_in_mask(S, pos + 1, STOPS);
+  size_t n = end - (pos + 1);
+
+  if (n > SCANNER_MAX_VALUE - 1)
+    n = SCANNER_MAX_VALUE - 1;
+
+  memcpy(value, S->data + pos + 1, n);
+  value[n] = '\0';
+
+  S->adjust++;  // the opening quote doesn't count
+
+  if (end < S->length && S->data[end] == quote)
+    return end + 1;
+
+  scanner_warnString(T.line, T.col);
+
+  return end;
+}
+
+
+//
+// structscan_scan
+//
+// Stage 2: emits the tokens, walking the structural index; see
+// structscan.h.
+//
+void structscan_scan(struct TokenArray* A, char* data, size_t length)
+{
+  structscan_scanLines(A, data, length, 1, NULL);
+}
+
+
+//
+// structscan_scanLines
+//
+// structscan_scan, numbering lines from firstLine and polling the
+// cancel token once per token; see structscan.h.
+//
+bool structscan_scanLines(struct TokenArray* A, char* data, size_t length, int firstLine, struct CancelToken* cancel)
+{
+  if (A == NULL) panic("A is NULL (structscan_scanLines)");
+  if (data == NULL && length > 0) panic("data is NULL (structscan_scanLines)");
+
+  struct Scan S;
+
+  S.data = (unsigned char*)data;
+  S.length = length;
+  S.base = S.limit = 0;
+  S.line = firstLine;
+  S.lineStart = 0;
+  S.adjust = 0;
+
+  char value[SCANNER_MAX_VALUE];
+  size_t pos = 0;
+  struct Token T;
+
+  while (true)
+  {
+    pos = next_start(&S, pos);
+
+    T.line = S.line;
+    T.col = (int)(pos - S.lineStart) + 1 - S.adjust;
+
+    if (cancel_poll(cancel))  // stop here, at the position reached
+    {
+      T.id = nuPy_EOS;
+      tokenarray_append(A, T, "$");
+      return false;
+    }
+
+    if (pos >= length)
+      break;
+
+    unsigned c = S.data[pos];
+    unsigned next = (pos + 1 < length) ? S.data[pos + 1] : 0;
+    bool real;
+
+    value[0] = (char)c;
+    value[1] = '\0';
+
+    switch (c)
+    {
+      case '$':
+        T.id = nuPy_EOS;
+        tokenarray_append(A, T, value);
+        return true;
+
+      case '#':  // the line advances at once, and the '\n' is consumed:
+      {
+        unsigned char* eoln = (unsigned char*)memchr(S.data + pos, '\n', length - pos);
+
+        pos = (eoln != NULL) ? (size_t)(eoln - S.data) + 1 : length;
+
+        S.line++;
+        S.lineStart = pos;
+        S.adjust = 0;
+        continue;
+      }
+
+      case '\'':
+      case '"':
+        T.id = nuPy_STR_LITERAL;
+        pos = collect_string(&S, pos, T, value);
+        break;
+
+      case '+':
+      case '-':
+        if (is_digit(next))
+        {
+          pos = collect_number(&S, pos + 1, value, 1, &real);
+          T.id = real ? nuPy_REAL_LITERAL : nuPy_INT_LITERAL;
+        }
+        else
+        {
+          T.id = (c == '+') ? nuPy_PLUS : nuPy_MINUS;
+          pos++;
+        }
+        break;
+
+      case '*':
+        T.id = (next == '*') ? nuPy_POWER : nuPy_ASTERISK;
+        break;
+
+      case '=':
+        T.id = (next == '=') ? nuPy_EQUALEQUAL : nuPy_EQUAL;
+        break;
+
+      case '<':
+        T.id = (next == '=') ? nuPy_LTE : nuPy_LT;
+        break;
+
+      case '>':
+        T.id = (next == '=') ? nuPy_GTE : nuPy_GT;
+        break;
+
+      case '!':
+        T.id = (next == '=') ? nuPy_NOTEQUAL : nuPy_UNKNOWN;
+        break;
+
+      case '(': T.id = nuPy_LEFT_PAREN; pos++; break;
+      case ')': T.id = nuPy_RIGHT_PAREN; pos++; break;
+      case '[': T.id = nuPy_LEFT_BRACKET; pos++; break;
+      case ']': T.id = nuPy_RIGHT_BRACKET; pos++; break;
+      case '{': T.id = nuPy_LEFT_BRACE; pos++; break;
+      case '}': T.id = nuPy_RIGHT_BRACE; pos++; break;
+      case '/': T.id = nuPy_SLASH; pos++; break;
+      case '%': T.id = nuPy_PERCENT; pos++; break;
+      case '&': T.id = nuPy_AMPERSAND; pos++; break;
+      case ':': T.id = nuPy_COLON; pos++; break;
+
+      default:
+        if (is_digit(c))
+        {
+          pos = collect_number(&S, pos, value, 0, &real);
+          T.id = real ? nuPy_REAL_LITERAL : nuPy_INT_LITERAL;
+        }
+        else if (is_ident(c))  // letter or underscore
+        {
+          size_t end = next_in_mask(&S, pos + 1, NONIDENT);
+          size_t n = end - pos;
+
+          if (n > SCANNER_MAX_VALUE - 1)
+            n = SCANNER_MAX_VALUE - 1;
+
+          memcpy(value, S.data + pos, n);
+          value[n] = '\0';
+
+          T.id = nuPy_IDENTIFIER;
+
+          unsigned k = keyword_slot(value, n);
+
+          if (Keywords[k].name != NULL && strcmp(Keywords[k].name, value) == 0)
+            T.id = Keywords[k].id;
+
+          pos = end;
+        }
+        else
+        {
+          T.id = nuPy_UNKNOWN;
+          pos++;
+        }
+        break;
+    }
+
+    //
+    // the two-char operators (and '!'), whose second char may follow:
+    //
+    if (c == '*' || c == '=' || c == '<' || c == '>' || c == '!')
+    {
+      pos++;
+
+      if (next == (unsigned)((c == '*') ? '*' : '='))
+      {
+        value[1] = (char)next;
+        value[2] = '\0';
+        pos++;
+      }
+    }
+
+    tokenarray_append(A, T, value);
+  }
+
+  T.id = nuPy_EOS;
+  tokenarray_append(A, T, "$");
+
+  return true;
+}
+
+
+//
+// read_file
+//
+// Reads the whole file into memory; returns NULL if it can't be read.
+//
+static char* read_file(char* filename, size_t* length)
+{
+  FILE* input = fopen(filename, "rb");
+  if (input == NULL)
+    return NULL;
+
+  size_t capacity = 4096;
+  char* data = (char*)allocMemory(capacity);
+  if (data == NULL) panic("out of memory (read_file)");
+
+  *length = 0;
+
+  size_t n;
+
+  while ((n = fread(data + *length, 1, capacity - *length, input)) > 0)
+  {
+    *length += n;
+
+    if (*length == capacity)
+    {
+      capacity *= 2;
+      data = (char*)reallocMemory(data, capacity);
+      if (data == NULL) panic("out of memory (read_file)");
+    }
+  }
+
+  fclose(input);
+
+  return data;
+}
+
+
+//
+// structscan_verify
+//
+// Compares both scanners on each file; see structscan.h.
+//
+int structscan_verify(char** files, int fileCount)
+{
+  int failures = 0;
+
+  for (int f = 0; f < fileCount; f++)
+  {
+    size_t length;
+    char* data = read_file(files[f], &length);
+
+    if (data == NULL)
+    {
+      printf("**ERROR: unable to open input file '%s' for input.\n", files[f]);
+      failures++;
+      continue;
+    }
+
+    struct TokenArray* expected = tokenarray_create();
+    struct TokenArray* actual = tokenarray_create();
+
+    if (length > 0)
+    {
+      FILE* input = fmemopen(data, length, "r");
+      if (input == NULL) panic("unable to open memory stream (structscan_verify)");
+
+      tokenarray_scan(expected, input);
+      fclose(input);
+    }
+    else
+    {
+      struct Token T = { nuPy_EOS, 1, 1 };
+      tokenarray_append(expected, T, "$");
+    }
+
+    structscan_scan(actual, data, length);
+
+    int i = 0;
+
+    while (i < expected->count && i < actual->count &&
+           expected->tokens[i].id == actual->tokens[i].id &&
+           expected->tokens[i].line == actual->tokens[i].line &&
+           expected->tokens[i].col == actual->tokens[i].col &&
+           strcmp(tokenarray_value(expected, i), tokenarray_value(actual, i)) == 0)
+      i++;
+
+    if (i == expected->count && i == actual->count)
+      printf("**STRUCT %s: %d tokens, identical\n", files[f], expected->count);
+    else
+    {
+      printf("**STRUCT %s: differs at token %d:", files[f], i);
+
+      if (i < expected->count)
+        printf(" scanner %d ('%s') @ (%d, %d)", expected->tokens[i].id, tokenarray_value(expected, i),
+          expected->tokens[i].line, expected->tokens[i].col);
+
+      if (i < actual->count)
+        printf(" structural %d ('%s') @ (%d, %d)", actual->tokens[i].id, tokenarray_value(actual, i),
+          actual->tokens[i].line, actual->tokens[i].col);
+
+      printf("\n");
+      failures++;
+    }
+
+    tokenarray_destroy(expected);
+    tokenarray_destroy(actual);
+    freeMemory(data);
+  }
+
+  return failures;
+}
@@ -0,0 +1,56 @@
+/*structscan.h*/
+
+#pragma once
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+
+#include "tokenarray.h"
+#include "cancel.h"
+
+
+//
+// structscan_scan
+//
+// Scans an in-memory input into the token array in two stages. Stage 1
+// classifies the input 64 bytes at a time (16 at a time with SSE2)
+// into bitmasks of whitespace, newlines, quotes and identifier
+// characters, and derives a structural index of the bytes that can
+// start a token. Stage 2 walks the index from token to token (counting
+// the newlines in between by popcount) and finds where identifiers and
+// string literals end from the masks; numbers and operators are
+// scanned byte by byte. This is the scanner for inputs already in
+// memory (batch, search and the benchmark); scanner_nextToken remains
+// the one for streams.
+//
+// The result is exactly what tokenarray_scan produces for the same
+// bytes via fmemopen: same ids, positions, values (truncated to
+// SCANNER_MAX_VALUE-1 chars) and warnings, ending with an EOS token at
+// the end of the input or at the first '$'.
+//
+void structscan_scan(struct TokenArray* A, char* data, size_t length);
+
+//
+// structscan_scanLines
+//
+// Like structscan_scan, but numbers the lines from firstLine, for an
+// input that is a piece of a larger one starting at a line boundary
+// (the tokens and any warnings then carry the larger input's lines).
+// The cancel token, if not NULL, is polled once per token; once it is
+// cancelled the scan stops, ending A with an EOS token at the position
+// reached, and false is returned.
+//
+bool structscan_scanLines(struct TokenArray* A, char* data, size_t length, int firstLine, struct CancelToken* cancel);
+
+//
+// structscan_verify
+//
+// Scans each file both with scanner_nextToken (tokenarray_scan) and
+// with structscan_scan, and compares the token arrays, outputting
+//
+//   **STRUCT file: N tokens, identical
+//
+// or the first token that differs. Returns the number of files that
+// differ or could not be read.
+//
+int structscan_verify(char** files, int fileCount);
@@ -0,0 +1,191 @@
+/*tokenarray.c*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>   // strlen, memcpy, memset
+#include <assert.h>   // assert
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+
+
+//
+// tokenarray_create
+//
+// Returns a new, empty token array; call tokenarray_destroy to free.
+//
+struct TokenArray* tokenarray_create(void)
+{
+  return tokenarray_createWith(NULL);
+}
+
+
+//
+// tokenarray_createWith
+//
+// Returns a new, empty token array using the given allocator.
+//
+struct TokenArray* tokenarray_createWith(struct Allocator* allocator)
+{
+  struct TokenArray* A = (struct TokenArray*)allocWith(allocator, sizeof(struct TokenArray));
+  if (A == NULL) panic("out of memory (tokenarray_createWith)");
+
+  A->allocator = allocator;
+  A->count = 0;
+  A->capacity = 256;
+  A->textLength = 0;
+  A->textCapacity = 4096;
+
+  A->ids = (signed char*)allocWith(allocator, A->capacity + TOKENARRAY_PADDING);
+  A->tokens = (struct Token*)allocWith(allocator, sizeof(struct Token) * A->capacity);
+  A->values = (int*)allocWith(allocator, sizeof(int) * A->capacity);
+  A->text = (char*)allocWith(allocator, A->textCapacity);
+
+  if (A->ids == NULL || A->tokens == NULL || A->values == NULL || A->text == NULL)
+    panic("out of memory (tokenarray_createWith)");
+
+  memset(A->ids, nuPy_UNKNOWN, A->capacity + TOKENARRAY_PADDING);
+
+  return A;
+}
+
+
+//
+// tokenarray_destroy
+//
+// Frees the memory associated with the token array.
+//
+void tokenarray_destroy(struct TokenArray* A)
+{
+  if (A == NULL)
+    return;
+
+  struct Allocator* allocator = A->allocator;
+
+  freeWith(allocator, A->ids);
+  freeWith(allocator, A->tokens);
+  freeWith(allocator, A->values);
+  freeWith(allocator, A->text);
+  freeWith(allocator, A);
+}
+
+
+//
+// tokenarray_reset
+//
+// Empties the array, keeping its memory; the ids of the old tokens
+// are cleared so the padding past the last token is still valid.
+//
+void tokenarray_reset(struct TokenArray* A)
+{
+  if (A == NULL) panic("A is NULL (tokenarray_reset)");
+
+  memset(A->ids, nuPy_UNKNOWN, A->count);
+
+  A->count = 0;
+  A->textLength = 0;
+}
+
+
+//
+// tokenarray_reserve
+//
+// Doubles the arrays until they are large enough.
+//
+void tokenarray_reserve(struct TokenArray* A, int tokens, int textLength)
+{
+  if (A == NULL) panic("A is NULL (tokenarray_reserve)");
+
+  if (tokens > A->capacity)
+  {
+    int old = A->capacity;
+
+    while (A->capacity < tokens)
+      A->capacity *= 2;
+
+    A->ids = (signed char*)reallocWith(A->allocator, A->ids, A->capacity + TOKENARRAY_PADDING);
+    A->tokens = (struct Token*)reallocWith(A->allocator, A->tokens, sizeof(struct Token) * A->capacity);
+    A->values = (int*)reallocWith(A->allocator, A->values, sizeof(int) * A->capacity);
+
+    if (A->ids == NULL || A->tokens == NULL || A->values == NULL)
+      panic("out of memory (tokenarray_reserve)");
+
+    memset(A->ids + old + TOKENARRAY_PADDING, nuPy_UNKNOWN, A->capacity - old);
+  }
+
+  while (textLength > A->textCapacity)
+  {
+    A->textCapacity *= 2;
+    A->text = (char*)reallocWith(A->allocator, A->text, A->textCapacity);
+    if (A->text == NULL) panic("out of memory (tokenarray_reserve)");
+  }
+}
+
+
+//
+// tokenarray_append
+//
+// Appends a copy of the given token and its value, growing the
+// arrays as needed.
+//
+void tokenarray_append(struct TokenArray* A, struct Token T, char* value)
+{
+  if (A == NULL || value == NULL)
+    panic("one or more parameters are NULL (tokenarray_append)");
+
+  assert(T.id >= -128 && T.id <= 127);  // must fit in ids[]
+
+  int L = (int)strlen(value) + 1;
+
+  if (A->count == A->capacity || A->textLength + L > A->textCapacity)
+    tokenarray_reserve(A, A->count + 1, A->textLength + L);
+
+  memcpy(A->text + A->textLength, value, L);
+
+  A->ids[A->count] = (signed char)T.id;
+  A->tokens[A->count] = T;
+  A->values[A->count] = A->textLength;
+
+  A->count++;
+  A->textLength += L;
+}
+
+
+//
+// tokenarray_value
+//
+// Returns the value of token i (owned by the array).
+//
+char* tokenarray_value(struct TokenArray* A, int i)
+{
+  assert(i >= 0 && i < A->count);
+
+  return A->text + A->values[i];
+}
+
+
+//
+// tokenarray_scan
+//
+// Scans the given input stream to the end, appending every token
+// including the final nuPy_EOS.
+//
+void tokenarray_scan(struct TokenArray* A, FILE* input)
+{
+  int lineNumber, colNumber;
+  char value[SCANNER_MAX_VALUE];
+
+  scanner_init(&lineNumber, &colNumber, value);
+
+  struct Token T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+
+  while (T.id != nuPy_EOS)
+  {
+    tokenarray_append(A, T, value);
+
+    T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+  }
+
+  tokenarray_append(A, T, value);
+}
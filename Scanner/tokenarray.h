@@ -0,0 +1,104 @@
+/*tokenarray.h*/
+
+#pragma once
+
+#include <stdio.h>
+#include "token.h"
+#include "util.h"   // Allocator
+
+
+//
+// TokenArray
+//
+// The scanned tokens of an input, stored as parallel arrays so that
+// consumers can sweep the token ids without touching anything else:
+//
+//   ids[i]     token id of token i, one byte per token (the array is
+//              padded with TOKENARRAY_PADDING bytes of nuPy_UNKNOWN so
+//              it can be read in wide blocks past the last token)
+//   tokens[i]  the full token (id, line, col)
+//   values[i]  offset of token i's value within text
+//   text       the values, NUL-terminated and back to back
+//
+// All of its memory comes from its allocator (NULL for the process
+// default), so e.g. the tokens of one request can live in that
+// request's arena.
+//
+#define TOKENARRAY_PADDING 64
+
+struct TokenArray
+{
+  signed char*  ids;
+  struct Token* tokens;
+  int*          values;
+  int           count;
+  int           capacity;
+
+  char*         text;
+  int           textLength;
+  int           textCapacity;
+
+  struct Allocator* allocator;
+};
+
+
+//
+// tokenarray_create
+//
+// Returns a new, empty token array, allocated from the process
+// default allocator; call tokenarray_destroy to free.
+//
+struct TokenArray* tokenarray_create(void);
+
+//
+// tokenarray_createWith
+//
+// Like tokenarray_create, but the array and everything it grows into
+// are allocated from the given allocator (NULL for the default).
+//
+struct TokenArray* tokenarray_createWith(struct Allocator* allocator);
+
+//
+// tokenarray_destroy
+//
+// Frees the memory associated with the token array.
+//
+void tokenarray_destroy(struct TokenArray* A);
+
+//
+// tokenarray_reset
+//
+// Empties the array but keeps its memory, so refilling it allocates
+// nothing until it grows past its previous size.
+//
+void tokenarray_reset(struct TokenArray* A);
+
+//
+// tokenarray_reserve
+//
+// Grows the array, if need be, to hold at least tokens tokens and
+// textLength bytes of values (including their NULs) in total.
+//
+void tokenarray_reserve(struct TokenArray* A, int tokens, int textLength);
+
+//
+// tokenarray_append
+//
+// Appends a copy of the given token and its value.
+//
+void tokenarray_append(struct TokenArray* A, struct Token T, char* value);
+
+//
+// tokenarray_value
+//
+// Returns the value of token i (owned by the array).
+//
+char* tokenarray_value(struct TokenArray* A, int i);
+
+//
+// tokenarray_scan
+//
+// Scans the given input stream to the end, appending every token
+// including the final nuPy_EOS.
+//
+void tokenarray_scan(struct TokenArray* A, FILE* input);
@@ -0,0 +1,561 @@
+/*tokencache.c*/
+
+//
+// On-disk token cache: token arrays in a dense variable-length
+// encoding, verified once when loaded so decoding can then run
+// without per-token bounds checks.
+//
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>   // true, false
+#include <stdint.h>    // uint64_t, int64_t
+#include <limits.h>    // INT_MAX
+#include <string.h>    // memcmp, memcpy, memchr, strlen, strcmp
+#include <unistd.h>    // getpid
+#include <stdatomic.h>
+#include <assert.h>    // assert
+#include <sys/stat.h>  // stat
+
+#include "util.h"
+#include "scanner.h"
+#include "tokenarray.h"
+#include "structscan.h"
+#include "tokencache.h"
+
+
+#define CACHE_MAGIC  "NUPYTOK2"
+#define EXPLICIT     0x80   // id byte flag: the value follows
+#define WARNED       0x40   // id byte flag: the scanner warned about it
+#define ID_MASK      0x3F
+#define MAX_VARINT   5      // bytes, enough for 32 bits
+#define ID_COUNT     (nuPy_KEYW_WHILE + 2)   // UNKNOWN .. WHILE
+
+static atomic_int TempCount = 0;  // makes temporary names unique
+
+//
+// TokenCacheHeader
+//
+// Start of an encoding, followed by the tokens.
+//
+struct TokenCacheHeader
+{
+  char     magic[8];     // CACHE_MAGIC
+  int64_t  sourceSize;
+  int64_t  sourceMtime;  // nanoseconds
+  uint32_t tokenCount;
+  uint32_t textLength;   // of the decoded values, including NULs
+  uint64_t bodyLength;   // of the encoded tokens
+  uint64_t bodyHash;     // hashBytes of the encoded tokens
+};
+
+
+//
+// the value implied by each id (indexed by id + 1), NULL if the value
+// varies and is stored:
+//
+static const char* Implied[ID_COUNT] =
+{
+  [nuPy_EOS + 1]           = "$",
+  [nuPy_LEFT_PAREN + 1]    = "(",
+  [nuPy_RIGHT_PAREN + 1]   = ")",
+  [nuPy_LEFT_BRACKET + 1]  = "[",
+  [nuPy_RIGHT_BRACKET + 1] = "]",
+  [nuPy_LEFT_BRACE + 1]    = "{",
+  [nuPy_RIGHT_BRACE + 1]   = "}",
+  [nuPy_PLUS + 1]          = "+",
+  [nuPy_MINUS + 1]         = "-",
+  [nuPy_ASTERISK + 1]      = "*",
+  [nuPy_POWER + 1]         = "**",
+  [nuPy_PERCENT + 1]       = "%",
+  [nuPy_SLASH + 1]         = "/",
+  [nuPy_EQUAL + 1]         = "=",
+  [nuPy_EQUALEQUAL + 1]    = "==",
+  [nuPy_NOTEQUAL + 1]      = "!=",
+  [nuPy_LT + 1]            = "<",
+  [nuPy_LTE + 1]           = "<=",
+  [nuPy_GT + 1]            = ">",
+  [nuPy_GTE + 1]           = ">=",
+  [nuPy_AMPERSAND + 1]     = "&",
+  [nuPy_COLON + 1]         = ":",
+  [nuPy_KEYW_AND + 1]      = "and",
+  [nuPy_KEYW_BREAK + 1]    = "break",
+  [nuPy_KEYW_CONTINUE + 1] = "continue",
+  [nuPy_KEYW_DEF + 1]      = "def",
+  [nuPy_KEYW_ELIF + 1]     = "elif",
+  [nuPy_KEYW_ELSE + 1]     = "else",
+  [nuPy_KEYW_FALSE + 1]    = "False",
+  [nuPy_KEYW_FOR + 1]      = "for",
+  [nuPy_KEYW_IF + 1]       = "if",
+  [nuPy_KEYW_IN + 1]       = "in",
+  [nuPy_KEYW_IS + 1]       = "is",
+  [nuPy_KEYW_NONE + 1]     = "None",
+  [nuPy_KEYW_NOT + 1]      = "not",
+  [nuPy_KEYW_OR + 1]       = "or",
+  [nuPy_KEYW_PASS + 1]     = "pass",
+  [nuPy_KEYW_RETURN + 1]   = "return",
+  [nuPy_KEYW_TRUE + 1]     = "True",
+  [nuPy_KEYW_WHILE + 1]    = "while"
+};
+
+
+//
+// varints: 7 bits per byte, low bits first, high bit set on all but
+// the last byte; signed deltas are zigzag-encoded first.
+//
+static void put_varint(struct StringBuilder* sb, uint32_t v)
+{
+  char bytes[MAX_VARINT];
+  int n = 0;
+
+  while (v >= 0x80)
+  {
+    bytes[n++] = (char)(v | 0x80);
+    v >>= 7;
+  }
+
+  bytes[n++] = (char)v;
+
+  sbAppendBytes(sb, bytes, (size_t)n);
+}
+
+static uint32_t zigzag(int32_t v)
+{
+  return ((uint32_t)v << 1) ^ (uint32_t)(v >> 31);
+}
+
+static int32_t unzigzag(uint32_t v)
+{
+  return (int32_t)(v >> 1) ^ -(int32_t)(v & 1);
+}
+
+//
+// read_varint: checked, for verification; returns false if the varint
+// runs past end or is longer than MAX_VARINT bytes.
+//
+static bool read_varint(unsigned char** p, unsigned char* end, uint32_t* v)
+{
+  uint64_t result = 0;
+
+  for (int n = 0; n < MAX_VARINT; n++)
+  {
+    if (*p >= end)
+      return false;
+
+    unsigned byte = *(*p)++;
+
+    result |= (uint64_t)(byte & 0x7F) << (7 * n);
+
+    if ((byte & 0x80) == 0)
+    {
+      if (result > UINT32_MAX)
+        return false;
+
+      *v = (uint32_t)result;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+//
+// next_varint: unchecked, for decoding verified input.
+//
+static inline uint32_t next_varint(unsigned char** p)
+{
+  uint32_t result = 0;
+  int shift = 0;
+  unsigned byte;
+
+  do
+  {
+    byte = *(*p)++;
+    result |= (uint32_t)(byte & 0x7F) << shift;
+    shift += 7;
+  } while (byte & 0x80);
+
+  return result;
+}
+
+
+//
+// tokencache_encode
+//
+// Encodes the tokens; see tokencache.h.
+//
+char* tokencache_encode(struct TokenArray* A, bool* warned, int64_t sourceSize, int64_t sourceMtime, size_t* length)
+{
+  if (A == NULL || length == NULL)
+    panic("one or more parameters are NULL (tokencache_encode)");
+
+  struct TokenCacheHeader header;
+  struct StringBuilder sb;
+
+  memset(&header, 0, sizeof(header));
+  sbInitWith(&sb, A->allocator);
+  sbAppendBytes(&sb, (char*)&header, sizeof(header));  // filled in below
+
+  int line = 1;
+
+  for (int i = 0; i < A->count; i++)
+  {
+    struct Token T = A->tokens[i];
+    char* value = tokenarray_value(A, i);
+
+    assert(T.id >= nuPy_UNKNOWN && T.id <= nuPy_KEYW_WHILE && T.id + 1 <= ID_MASK);
+    assert(warned == NULL || !warned[i] || T.id == nuPy_STR_LITERAL);
+
+    const char* implied = Implied[T.id + 1];
+    bool explicit = (implied == NULL || strcmp(implied, value) != 0);
+    bool warn = (warned != NULL && warned[i]);
+    char id = (char)((T.id + 1) | (explicit ? EXPLICIT : 0) | (warn ? WARNED : 0));
+
+    sbAppendBytes(&sb, &id, 1);
+    put_varint(&sb, zigzag(T.line - line));
+    put_varint(&sb, (uint32_t)T.col);
+
+    if (explicit)
+    {
+      size_t n = strlen(value);
+
+      put_varint(&sb, (uint32_t)n);
+      sbAppendBytes(&sb, value, n);
+    }
+
+    line = T.line;
+  }
+
+  memcpy(header.magic, CACHE_MAGIC, 8);
+  header.sourceSize = sourceSize;
+  header.sourceMtime = sourceMtime;
+  header.tokenCount = (uint32_t)A->count;
+  header.textLength = (uint32_t)A->textLength;
+  header.bodyLength = sb.length - sizeof(header);
+  header.bodyHash = hashBytes(sb.data + sizeof(header), sb.length - sizeof(header));
+
+  memcpy(sb.data, &header, sizeof(header));
+
+  *length = sb.length;
+
+  return sbFinish(&sb);
+}
+
+
+//
+// verify
+//
+// The load-time check of the encoded tokens, see tokencache_decode;
+// everything next_varint and decode rely on is established here.
+//
+static bool verify(struct TokenCacheHeader* header, unsigned char* p, unsigned char* end)
+{
+  uint64_t text = 0;
+  int64_t line = 1;
+
+  if (header->tokenCount == 0 || header->tokenCount > INT_MAX || header->textLength > INT_MAX)
+    return false;
+
+  for (uint32_t i = 0; i < header->tokenCount; i++)
+  {
+    if (p >= end)
+      return false;
+
+    unsigned byte = *p++;
+    int id = (int)(byte & ID_MASK) - 1;
+
+    if (id > nuPy_KEYW_WHILE || (id == nuPy_EOS) != (i == header->tokenCount - 1))
+      return false;
+
+    if ((byte & WARNED) && id != nuPy_STR_LITERAL)  // only strings warn
+      return false;
+
+    uint32_t delta, col, n;
+
+    if (!read_varint(&p, end, &delta) || !read_varint(&p, end, &col))
+      return false;
+
+    line += unzigzag(delta);
+
+    if (line < 1 || line > INT_MAX || col < 1 || col > INT_MAX)
+      return false;
+
+    if (byte & EXPLICIT)
+    {
+      if (!read_varint(&p, end, &n) || n >= SCANNER_MAX_VALUE || n > (size_t)(end - p) || memchr(p, '\0', n) != NULL)
+        return false;
+
+      p += n;
+    }
+    else if (Implied[id + 1] == NULL)
+      return false;
+    else
+      n = (uint32_t)strlen(Implied[id + 1]);
+
+    text += n + 1;
+  }
+
+  return p == end && text == header->textLength;
+}
+
+
+//
+// tokencache_decode
+//
+// Verifies, then decodes; see tokencache.h.
+//
+bool tokencache_decode(struct TokenArray* A, char* data, size_t length, int64_t sourceSize, int64_t sourceMtime)
+{
+  if (A == NULL || data == NULL)
+    panic("one or more parameters are NULL (tokencache_decode)");
+
+  struct TokenCacheHeader header;
+
+  if (length < sizeof(header))
+    return false;
+
+  memcpy(&header, data, sizeof(header));  // data may be unaligned
+
+  unsigned char* p = (unsigned char*)data + sizeof(header);
+  unsigned char* end = (unsigned char*)data + length;
+
+  if (memcmp(header.magic, CACHE_MAGIC, 8) != 0 || header.bodyLength != (uint64_t)(end - p) ||
+      header.sourceSize != sourceSize || header.sourceMtime != sourceMtime)
+    return false;
+
+  //
+  // the hash catches corruption that would still decode, e.g. a changed
+  // line delta; verify then makes decoding safe even if it collides:
+  //
+  if (hashBytes((char*)p, (size_t)(end - p)) != header.bodyHash)
+    return false;
+
+  if (!verify(&header, p, end))
+    return false;
+
+  if ((int64_t)A->count + header.tokenCount > INT_MAX || (int64_t)A->textLength + header.textLength > INT_MAX)
+    return false;
+
+  tokenarray_reserve(A, A->count + (int)header.tokenCount, A->textLength + (int)header.textLength);
+
+  int line = 1;
+
+  for (uint32_t i = 0; i < header.tokenCount; i++)
+  {
+    unsigned byte = *p++;
+    struct Token T;
+
+    line += unzigzag(next_varint(&p));
+
+    T.id = (int)(byte & ID_MASK) - 1;
+    T.line = line;
+    T.col = (int)next_varint(&p);
+
+    if (byte & WARNED)  // as the scanner did when it scanned the token
+      scanner_warnString(T.line, T.col);
+
+    char* text = A->text + A->textLength;
+    size_t n;
+
+    if (byte & EXPLICIT)
+    {
+      n = next_varint(&p);
+      memcpy(text, p, n);
+      p += n;
+    }
+    else
+    {
+      n = strlen(Implied[T.id + 1]);
+      memcpy(text, Implied[T.id + 1], n);
+    }
+
+    text[n] = '\0';
+
+    A->ids[A->count] = (signed char)T.id;
+    A->tokens[A->count] = T;
+    A->values[A->count] = A->textLength;
+
+    A->count++;
+    A->textLength += (int)n + 1;
+  }
+
+  return true;
+}
+
+
+//
+// read_file
+//
+// Reads the whole file into memory from the given allocator; returns
+// NULL if it can't be read.
+//
+static char* read_file(char* path, size_t* length, struct Allocator* allocator)
+{
+  FILE* input = fopen(path, "rb");
+  if (input == NULL)
+    return NULL;
+
+  struct stat st;
+
+  if (fstat(fileno(input), &st) < 0)
+  {
+    fclose(input);
+    return NULL;
+  }
+
+  char* data = (char*)allocWith(allocator, (size_t)st.st_size + 1);
+  if (data == NULL) panic("out of memory (read_file)");
+
+  *length = fread(data, 1, (size_t)st.st_size, input);
+  fclose(input);
+
+  return data;
+}
+
+
+//
+// tokencache_scanFile
+//
+// Scans the file, through the cache if there is one; see tokencache.h.
+//
+bool tokencache_scanFile(struct TokenArray* A, char* path, char* cacheDir, bool* hit)
+{
+  if (A == NULL || path == NULL || hit == NULL)
+    panic("one or more parameters are NULL (tokencache_scanFile)");
+
+  *hit = false;
+
+  struct stat st;
+
+  if (stat(path, &st) < 0)
+    return false;
+
+  int64_t size = (int64_t)st.st_size;
+  int64_t mtime = (int64_t)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+
+  //
+  // the cache entry is named by a hash of the path:
+  //
+  struct StringBuilder cachePath;
+
+  sbInitWith(&cachePath, A->allocator);
+
+  if (cacheDir != NULL)
+  {
+    sbAppendFormat(&cachePath, "%s/%016llx.tok", cacheDir, (unsigned long long)hashBytes(path, strlen(path)));
+
+    size_t length;
+    char* data = read_file(cachePath.data, &length, A->allocator);
+
+    if (data != NULL)
+    {
+      *hit = tokencache_decode(A, data, length, size, mtime);
+      freeWith(A->allocator, data);
+    }
+
+    if (*hit)
+    {
+      sbFree(&cachePath);
+      return true;
+    }
+  }
+
+  if (cacheDir == NULL)  // no cache, scan in memory with the structural scanner
+  {
+    sbFree(&cachePath);
+
+    size_t length;
+    char* data = read_file(path, &length, A->allocator);
+
+    if (data == NULL)
+      return false;
+
+    structscan_scan(A, data, length);
+    freeWith(A->allocator, data);
+
+    return true;
+  }
+
+  FILE* input = fopen(path, "r");
+
+  if (input == NULL)
+  {
+    sbFree(&cachePath);
+    return false;
+  }
+
+  //
+  // scan token by token, noting which tokens the scanner warned about,
+  // so a later hit can output the same warnings:
+  //
+  int first = A->count;
+  int capacity = 256;
+  bool* warned = (bool*)allocWith(A->allocator, sizeof(bool) * capacity);
+  if (warned == NULL) panic("out of memory (tokencache_scanFile)");
+
+  int lineNumber, colNumber;
+  char value[SCANNER_MAX_VALUE];
+  struct Token T;
+
+  scanner_init(&lineNumber, &colNumber, value);
+
+  do
+  {
+    long warnings = scanner_warningCount();
+
+    T = scanner_nextToken(input, &lineNumber, &colNumber, value);
+    tokenarray_append(A, T, value);
+
+    if (A->count - first > capacity)
+    {
+      capacity *= 2;
+      warned = (bool*)reallocWith(A->allocator, warned, sizeof(bool) * capacity);
+      if (warned == NULL) panic("out of memory (tokencache_scanFile)");
+    }
+
+    warned[A->count - first - 1] = (scanner_warningCount() != warnings);
+  } while (T.id != nuPy_EOS);
+
+  fclose(input);
+
+  {
+    //
+    // write to a temporary and rename, so a concurrent reader never
+    // sees a partial entry (it would fail verification anyway):
+    //
+    struct TokenArray tokens = *A;  // just the tokens scanned here
+
+    tokens.ids += first;
+    tokens.tokens += first;
+    tokens.values += first;
+    tokens.count -= first;
+
+    size_t length;
+    char* data = tokencache_encode(&tokens, warned, size, mtime, &length);
+
+    struct StringBuilder tempPath;
+
+    sbInitWith(&tempPath, A->allocator);
+    sbAppendFormat(&tempPath, "%s.%ld.%d.tmp", cachePath.data, (long)getpid(), atomic_fetch_add(&TempCount, 1));
+
+    FILE* output = fopen(tempPath.data, "wb");
+
+    if (output != NULL)
+    {
+      bool ok = fwrite(data, 1, length, output) == length;
+
+      if (fclose(output) != 0 || !ok || rename(tempPath.data, cachePath.data) != 0)
+        remove(tempPath.data);
+    }
+
+    sbFree(&tempPath);
+    freeWith(A->allocator, data);
+  }
+
+  freeWith(A->allocator, warned);
+  sbFree(&cachePath);
+
+  return true;
+}
@@ -0,0 +1,50 @@
+/*tokencache.h*/
+
+#pragma once
+
+#include <stdbool.h>  // bool
+#include <stddef.h>   // size_t
+#include <stdint.h>   // int64_t
+
+#include "tokenarray.h"
+
+
+//
+// tokencache_encode
+//
+// Encodes the token array compactly: per token, a 1-byte id, the line
+// as a varint delta from the previous token's, the column as a varint,
+// and the value only when the id doesn't imply it (identifiers,
+// literals, unknown chars). warned, if not NULL, flags the tokens the
+// scanner output a warning for; the flag is kept in the id byte.
+// sourceSize and sourceMtime identify the source the tokens were
+// scanned from. Returns the encoding, allocated from A's allocator and
+// to be freed with freeWith(A->allocator, ...); its length is returned
+// via length.
+//
+char* tokencache_encode(struct TokenArray* A, bool* warned, int64_t sourceSize, int64_t sourceMtime, size_t* length);
+
+//
+// tokencache_decode
+//
+// Verifies an encoding in one pass (header, hash, every id, varint,
+// line, column and value length within bounds, EOS last and only
+// last, and the declared counts) and only then decodes it into A,
+// appending, in a second pass that needs no further checks; the
+// warnings of flagged tokens are output again via scanner_warnString.
+// Returns false, leaving A unchanged, if the encoding is invalid or
+// wasn't made from a source of the given size and mtime.
+//
+bool tokencache_decode(struct TokenArray* A, char* data, size_t length, int64_t sourceSize, int64_t sourceMtime);
+
+//
+// tokencache_scanFile
+//
+// Scans the file into A. If cacheDir is not NULL, the tokens are read
+// from the file's entry in cacheDir instead when it is valid and the
+// file hasn't changed since (setting *hit), and otherwise the entry is
+// (re)written after scanning. Either way the scanner's warnings are
+// output the same. Everything allocated on the way comes from A's
+// allocator. Returns false if the file can't be read.
+//
+bool tokencache_scanFile(struct TokenArray* A, char* path, char* cacheDir, bool* hit);
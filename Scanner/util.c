@@ -4,10 +4,12 @@
 
 #include <stdio.h>
 #include <stdlib.h>
-#include <string.h>  // strcpy, strcspn
+#include <stdarg.h>  // va_list
+#include <string.h>  // strlen, strcspn, memcpy, memset
 #include <ctype.h>   // tolower
 
 #include "util.h"
+#include "flightrec.h"
 
 
 //
@@ -23,10 +25,131 @@ void panic(char* msg)
    printf("**PANIC: %s\n", msg);
    printf("**PANIC\n");
 
+   fflush(stdout);
+   flightrec_dump("panic");
+
    exit(-1);
 }
 
 
+//
+// default allocator, malloc and friends:
+//
+static void* defaultAlloc(void* context, size_t size)
+{
+  (void)context;
+  return malloc(size);
+}
+
+static void* defaultRealloc(void* context, void* p, size_t size)
+{
+  (void)context;
+  return realloc(p, size);
+}
+
+static void defaultFree(void* context, void* p)
+{
+  (void)context;
+  free(p);
+}
+
+static struct Allocator DefaultAllocator = { defaultAlloc, defaultRealloc, defaultFree, NULL };
+static struct Allocator* CurrentAllocator = &DefaultAllocator;
+
+
+//
+// setAllocator
+//
+// Installs the given allocator for all subsequent allocations; NULL
+// restores the default (malloc).
+//
+void setAllocator(struct Allocator* allocator)
+{
+  if (allocator != NULL && (allocator->alloc == NULL || allocator->realloc == NULL || allocator->free == NULL))
+    panic("allocator is missing a function (setAllocator)");
+
+  CurrentAllocator = (allocator == NULL) ? &DefaultAllocator : allocator;
+}
+
+
+//
+// getAllocator
+//
+// Returns the current allocator.
+//
+struct Allocator* getAllocator(void)
+{
+  return CurrentAllocator;
+}
+
+
+//
+// allocMemory, callocMemory, reallocMemory, freeMemory
+//
+// Allocate and free memory through the current allocator.
+//
+void* allocMemory(size_t size)
+{
+  return CurrentAllocator->alloc(CurrentAllocator->context, size);
+}
+
+void* callocMemory(size_t count, size_t size)
+{
+  if (size != 0 && count > SIZE_MAX / size)
+    return NULL;
+
+  void* p = CurrentAllocator->alloc(CurrentAllocator->context, count * size);
+
+  if (p != NULL)
+    memset(p, 0, count * size);
+
+  return p;
+}
+
+void* reallocMemory(void* p, size_t size)
+{
+  return CurrentAllocator->realloc(CurrentAllocator->context, p, size);
+}
+
+void freeMemory(void* p)
+{
+  if (p != NULL)
+    CurrentAllocator->free(CurrentAllocator->context, p);
+}
+
+
+//
+// allocWith, reallocWith, freeWith
+//
+// Allocate and free memory through the given allocator, or the
+// process default if it is NULL.
+//
+void* allocWith(struct Allocator* allocator, size_t size)
+{
+  if (allocator == NULL)
+    allocator = CurrentAllocator;
+
+  return allocator->alloc(allocator->context, size);
+}
+
+void* reallocWith(struct Allocator* allocator, void* p, size_t size)
+{
+  if (allocator == NULL)
+    allocator = CurrentAllocator;
+
+  return allocator->realloc(allocator->context, p, size);
+}
+
+void freeWith(struct Allocator* allocator, void* p)
+{
+  if (allocator == NULL)
+    allocator = CurrentAllocator;
+
+  if (p != NULL)
+    allocator->free(allocator->context, p);
+}
+
+
 //
 // dupString
 // 
@@ -44,10 +167,12 @@ char* dupString(char* s)
   //
   // be sure to include extra location for null terminator:
   //
-  char* copy = (char*)malloc(sizeof(char) * (strlen(s) + 1));
+  size_t L = strlen(s) + 1;
+
+  char* copy = (char*)allocMemory(sizeof(char) * L);
   if (copy == NULL) panic("out of memory (dupString)");
 
-  strcpy(copy, s);
+  memcpy(copy, s, L);
 
   return copy;
 }
@@ -71,11 +196,14 @@ char* dupStrings(char* s1, char *s2)
   //
   // be sure to include extra location for null terminator:
   //
-  char* copy = (char*)malloc(sizeof(char) * (strlen(s1) + strlen(s2) + 1));
+  size_t L1 = strlen(s1);
+  size_t L2 = strlen(s2) + 1;
+
+  char* copy = (char*)allocMemory(sizeof(char) * (L1 + L2));
   if (copy == NULL) panic("out of memory (dupStrings)");
 
-  strcpy(copy, s1);
-  strcat(copy, s2);
+  memcpy(copy, s1, L1);
+  memcpy(copy + L1, s2, L2);  // includes the null terminator
 
   return copy;
 }
@@ -99,10 +227,12 @@ char* dupAndStripEOLN(char* s)
   //
   // be sure to include extra location for null terminator:
   //
-  char* copy = (char*)malloc(sizeof(char) * (strlen(s) + 1));
+  size_t L = strlen(s) + 1;
+
+  char* copy = (char*)allocMemory(sizeof(char) * L);
   if (copy == NULL) panic("out of memory (dupAndStripEOLN)");
 
-  strcpy(copy, s);
+  memcpy(copy, s, L);
 
   // delete EOL chars LF, CR, CRLF, LFCR, etc.
   copy[strcspn(copy, "\r\n")] = '\0';
@@ -148,3 +278,240 @@ int icmpStrings(char* s1, char* s2)
   // if get here, match!
   return 0;
 }
+
+
+//
+// hashBytes
+//
+// Fast non-cryptographic 64-bit hash of the given bytes. The input
+// is consumed 8 bytes at a time, and the result is passed through
+// the splitmix64 finalizer so all bits are well mixed.
+//
+uint64_t hashBytes(const char* data, size_t length)
+{
+  if (data == NULL && length > 0) panic("data is NULL (hashBytes)");
+
+  const uint64_t M = 0x9E3779B97F4A7C15ULL;
+
+  uint64_t h = M ^ (length * 0xFF51AFD7ED558CCDULL);
+  size_t i = 0;
+
+  for (; i + 8 <= length; i += 8)
+  {
+    uint64_t w;
+    memcpy(&w, data + i, 8);
+
+    h = (h ^ w) * M;
+    h ^= h >> 29;
+  }
+
+  uint64_t w = 0;
+  if (i < length)
+    memcpy(&w, data + i, length - i);  // the last 1..7 bytes
+
+  h = (h ^ w) * M;
+
+  h ^= h >> 30;
+  h *= 0xBF58476D1CE4E5B9ULL;
+  h ^= h >> 27;
+  h *= 0x94D049BB133111EBULL;
+  h ^= h >> 31;
+
+  return h;
+}
+
+
+//
+// sbInit
+//
+// Initializes an empty string builder.
+//
+void sbInit(struct StringBuilder* sb)
+{
+  sbInitWith(sb, NULL);
+}
+
+
+//
+// sbInitWith
+//
+// Initializes an empty string builder using the given allocator.
+//
+void sbInitWith(struct StringBuilder* sb, struct Allocator* allocator)
+{
+  if (sb == NULL) panic("sb is NULL (sbInitWith)");
+
+  sb->data = NULL;
+  sb->length = 0;
+  sb->capacity = 0;
+  sb->allocator = allocator;
+}
+
+
+//
+// sbReserve
+//
+// Ensures there is room for extra more chars plus the terminator,
+// at least doubling the buffer whenever it grows.
+//
+static void sbReserve(struct StringBuilder* sb, size_t extra)
+{
+  size_t needed = sb->length + extra + 1;
+
+  if (needed <= sb->capacity)
+    return;
+
+  size_t capacity = (sb->capacity < 64) ? 64 : sb->capacity * 2;
+  if (capacity < needed)
+    capacity = needed;
+
+  sb->data = (char*)reallocWith(sb->allocator, sb->data, capacity);
+  if (sb->data == NULL) panic("out of memory (sbReserve)");
+
+  sb->capacity = capacity;
+}
+
+
+//
+// sbAppendBytes
+//
+// Appends the given bytes.
+//
+void sbAppendBytes(struct StringBuilder* sb, const char* bytes, size_t length)
+{
+  if (sb == NULL) panic("sb is NULL (sbAppendBytes)");
+  if (bytes == NULL && length > 0) panic("bytes is NULL (sbAppendBytes)");
+
+  sbReserve(sb, length);
+
+  if (length > 0)
+    memcpy(sb->data + sb->length, bytes, length);
+
+  sb->length += length;
+  sb->data[sb->length] = '\0';
+}
+
+
+//
+// sbAppend
+//
+// Appends the given string.
+//
+void sbAppend(struct StringBuilder* sb, const char* s)
+{
+  if (s == NULL) panic("s is NULL (sbAppend)");
+
+  sbAppendBytes(sb, s, strlen(s));
+}
+
+
+//
+// sbAppendInt
+//
+// Appends the given integer in decimal, without going through printf.
+//
+void sbAppendInt(struct StringBuilder* sb, long value)
+{
+  char digits[24];
+  int i = sizeof(digits);
+
+  // work with the magnitude as unsigned so LONG_MIN is safe:
+  unsigned long magnitude = (value < 0) ? 0UL - (unsigned long)value : (unsigned long)value;
+
+  do
+  {
+    digits[--i] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+
+  if (value < 0)
+    digits[--i] = '-';
+
+  sbAppendBytes(sb, digits + i, sizeof(digits) - i);
+}
+
+
+//
+// sbAppendFormat
+//
+// Appends printf-style formatted text, formatting directly into the
+// buffer (and once more if it had to grow).
+//
+void sbAppendFormat(struct StringBuilder* sb, const char* format, ...)
+{
+  if (sb == NULL) panic("sb is NULL (sbAppendFormat)");
+  if (format == NULL) panic("format is NULL (sbAppendFormat)");
+
+  sbReserve(sb, 0);
+
+  va_list args;
+
+  va_start(args, format);
+  int n = vsnprintf(sb->data + sb->length, sb->capacity - sb->length, format, args);
+  va_end(args);
+
+  if (n < 0)
+    panic("invalid format (sbAppendFormat)");
+
+  if ((size_t)n >= sb->capacity - sb->length)  // didn't fit, grow and redo:
+  {
+    sbReserve(sb, (size_t)n);
+
+    va_start(args, format);
+    vsnprintf(sb->data + sb->length, sb->capacity - sb->length, format, args);
+    va_end(args);
+  }
+
+  sb->length += (size_t)n;
+}
+
+
+//
+// sbFinish
+//
+// Returns the built string (owned by the caller) and empties the
+// builder.
+//
+char* sbFinish(struct StringBuilder* sb)
+{
+  if (sb == NULL) panic("sb is NULL (sbFinish)");
+
+  sbReserve(sb, 0);  // so an empty builder still returns ""
+  sb->data[sb->length] = '\0';
+
+  char* s = sb->data;
+
+  sbInitWith(sb, sb->allocator);
+
+  return s;
+}
+
+
+//
+// sbReset
+//
+// Empties the builder, keeping its buffer.
+//
+void sbReset(struct StringBuilder* sb)
+{
+  if (sb == NULL) panic("sb is NULL (sbReset)");
+
+  sb->length = 0;
+
+  if (sb->data != NULL)
+    sb->data[0] = '\0';
+}
+
+
+//
+// sbFree
+//
+// Frees the builder's buffer.
+//
+void sbFree(struct StringBuilder* sb)
+{
+  if (sb == NULL) panic("sb is NULL (sbFree)");
+
+  freeWith(sb->allocator, sb->data);
+  sbInitWith(sb, sb->allocator);
+}
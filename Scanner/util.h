@@ -2,6 +2,47 @@
 
 #pragma once
 
+#include <stddef.h>  // size_t
+#include <stdint.h>  // uint64_t
+
+
+//
+// Allocator
+//
+// A pluggable memory allocator. A context that allocates, such as a
+// TokenArray, can be given its own (e.g. an arena or per-request
+// accounting), and allocates everything through it; anything without
+// one uses the process default (see setAllocator), which by default is
+// malloc/realloc/free. The context is passed through to each function
+// untouched.
+//
+struct Allocator
+{
+  void* (*alloc)(void* context, size_t size);
+  void* (*realloc)(void* context, void* p, size_t size);
+  void  (*free)(void* context, void* p);
+  void*  context;
+};
+
+
+//
+// StringBuilder
+//
+// A growable, length-tracked string. Appends are amortized O(1): the
+// buffer grows geometrically and is never rescanned, unlike repeated
+// strcat/dupStrings. The data is always '\0'-terminated (once anything
+// has been appended). Initialize with sbInit, or sbInitWith to have
+// the buffer allocated by a given allocator.
+//
+struct StringBuilder
+{
+  char*  data;
+  size_t length;
+  size_t capacity;
+
+  struct Allocator* allocator;  // NULL for the process default
+};
+
 
 //
 // panic
@@ -12,6 +53,46 @@
 //
 void panic(char* msg);
 
+//
+// setAllocator
+//
+// Installs the given allocator as the process default, used for all
+// subsequent allocations not made through a context's own allocator;
+// NULL restores malloc. Install it before any allocations are made or
+// threads are started, since memory must be freed by the allocator it
+// came from.
+//
+void setAllocator(struct Allocator* allocator);
+
+//
+// getAllocator
+//
+// Returns the process default allocator.
+//
+struct Allocator* getAllocator(void);
+
+//
+// allocMemory, callocMemory, reallocMemory, freeMemory
+//
+// Allocate and free memory through the process default allocator;
+// these behave like malloc, calloc, realloc and free (including
+// returning NULL when out of memory).
+//
+void* allocMemory(size_t size);
+void* callocMemory(size_t count, size_t size);
+void* reallocMemory(void* p, size_t size);
+void  freeMemory(void* p);
+
+//
+// allocWith, reallocWith, freeWith
+//
+// Like allocMemory, reallocMemory and freeMemory, but through the
+// given allocator, or the process default if it is NULL.
+//
+void* allocWith(struct Allocator* allocator, size_t size);
+void* reallocWith(struct Allocator* allocator, void* p, size_t size);
+void  freeWith(struct Allocator* allocator, void* p);
+
 //
 // dupString
 // 
@@ -59,3 +140,67 @@ char* dupAndStripEOLN(char* s);
 // Example: icmpStrings("apple", "APPLE") returns 0
 //
 int icmpStrings(char* s1, char* s2);
+
+//
+// hashBytes
+//
+// Fast non-cryptographic 64-bit hash of the given bytes, suitable
+// for hash tables and for detecting identical file contents (equal
+// hashes should still be confirmed by comparing the bytes).
+//
+uint64_t hashBytes(const char* data, size_t length);
+
+//
+// sbInit
+//
+// Initializes an empty string builder; nothing is allocated until the
+// first append.
+//
+void sbInit(struct StringBuilder* sb);
+
+//
+// sbInitWith
+//
+// Like sbInit, but the buffer comes from the given allocator (NULL for
+// the default), and so must the string sbFinish returns be freed with
+// it (see freeWith).
+//
+void sbInitWith(struct StringBuilder* sb, struct Allocator* allocator);
+
+//
+// sbAppendBytes, sbAppend, sbAppendInt, sbAppendFormat
+//
+// Append the given bytes, string, integer (in decimal), or printf-style
+// formatted text to the end of the builder, growing it as needed.
+//
+void sbAppendBytes(struct StringBuilder* sb, const char* bytes, size_t length);
+void sbAppend(struct StringBuilder* sb, const char* s);
+void sbAppendInt(struct StringBuilder* sb, long value);
+void sbAppendFormat(struct StringBuilder* sb, const char* format, ...)
+  __attribute__((format(printf, 2, 3)));
+
+//
+// sbFinish
+//
+// Returns the built string and leaves the builder empty, ready for
+// reuse.
+//
+// NOTE: the caller takes ownership of the string and must
+// eventually free it with freeMemory.
+//
+char* sbFinish(struct StringBuilder* sb);
+
+//
+// sbReset
+//
+// Empties the builder but keeps its buffer, so building the next
+// string allocates nothing unless it is longer.
+//
+void sbReset(struct StringBuilder* sb);
+
+//
+// sbFree
+//
+// Frees the builder's buffer.
+//
+void sbFree(struct StringBuilder* sb);